@@ -9,6 +9,45 @@
 #include<stdexcept>		// for error types such as std::invalid_argument()
 #include<fstream>		// for ifstream to read a file
 #include<regex> 		// for regex use inside operator>>()
+#include<cstdint>		// for uint64_t
+#include<cctype>		// for isalpha(), tolower()
+#include<map>			// for std::map
+#include<algorithm>		// for std::stable_sort(), std::equal()
+#include<memory>		// for std::unique_ptr
+#include<deque>			// for std::deque (Bounded_queue)
+#include<thread>		// for std::thread (decompression thread)
+#include<mutex>
+#include<condition_variable>
+#include<exception>		// for std::exception_ptr
+#include<cerrno>
+#include<cstring>		// for strerror()
+#include<atomic>		// for std::atomic (Spsc_queue)
+#include<chrono>		// for the time measurement of pipeline stages
+#include<functional>		// for std::function (Entry_listener)
+#include<unordered_map>		// for std::unordered_map (Space_saving)
+#include<cmath>			// for pow() (Kll_sketch)
+#include<limits>		// for std::numeric_limits
+#include<iterator>		// for std::back_inserter
+#include<fcntl.h>		// for open(), posix_fadvise()
+#include<unistd.h>		// for pipe(), fork(), read()
+#include<sys/wait.h>		// for waitpid()
+#include<signal.h>		// for kill()
+#include<sys/stat.h>		// for stat() (--person-from owner)
+#include<pwd.h>			// for getpwuid()
+#include<dirent.h>		// for opendir() (directories of timeline files)
+#include<sys/mman.h>		// for shm_open(), mmap() (count_times publish)
+#ifdef __SSE2__
+#include<emmintrin.h>		// for SSE2 intrinsics (normalize_utf8())
+#endif
+#ifdef USE_ZLIB
+#include<zlib.h>		// compile with -DUSE_ZLIB ... -lz
+#endif
+#ifdef USE_ZSTD
+#include<zstd.h>		// compile with -DUSE_ZSTD ... -lzstd
+#endif
+#ifdef USE_IO_URING
+#include<liburing.h>		// compile with -DUSE_IO_URING ... -luring
+#endif
 
 /*
   Assumed timeline format:
@@ -28,9 +67,25 @@
 
 using namespace std;
 
-tm date;
+thread_local tm date;
 // date for the current file
 // made global for operator>>(istream& is, Timeline& t) to access it
+// <- made thread_local for the pipeline mode (--pipeline), where several threads parse timelines at the same time.
+//    Each parser thread has its own copy. operator>>() uses it only as the reference date of sub-activity time stamps
+//    (e.g. (s 12:20 - 12:30)), and their durations don't depend on it, so the parser threads' copies are simply set to
+//    1/1/1970. The date rollover is tracked by the thread running Ingest.
+
+// What operator>>(istream& is, Timeline& t) decodes after the time stamp (projection pushdown).
+// Everything is decoded by default. main() turns off what none of the requested outputs reads before reading any file
+// (parser threads only read it, so it's not thread_local like date):
+//  - subs=false (--main-only): sub-activities are ignored (their time stays in the main activity). The rest of the line
+//    is read only for the main activity's task digit ("- T 12:00 did task 1"). Other lines stop at the time stamp.
+//  - content=false: the content is parsed for sub-activities but not kept in Timeline::activity_content.
+struct Parse_fields {
+  bool subs{true};
+  bool content{true};
+};
+Parse_fields parse_fields;
 
 enum class activity_type {not_set=1, task, wasteful, house_chore, social, write_log,
 			  miscellaneous, exercise, travel, rest, pastime, error};
@@ -41,6 +96,227 @@ enum class activity_type {not_set=1, task, wasteful, house_chore, social, write_
 // <- later, to make this enum class accessible to Abst_Timeline and Sub_Timeline, I placed this enum class outside of
 //    Timeline class.
 // "error" activity_type is used to indicate that a given character in convert_c2a() is not any of the assigned characters
+// <- the enum members above are now only the BUILT-IN categories. Categories loaded from a taxonomy file (see Taxonomy
+//    below) get the values after error, e.g. activity_type(int(activity_type::error)+1), so int(activity_type) can still
+//    be used as an index of a vector like record_act_time_vec.
+
+// One category of the activity taxonomy (e.g. task, or "code review" added by a taxonomy file)
+struct Activity_category {
+  string id;			// identifier used in a taxonomy file, e.g. "task", "code_review"
+  string name;			// returned by convert_a2s(), e.g. "Task"
+  string label;			// used in the report, "Total <label> time: ..."
+  vector<string> codes;		// lowercase codes typed in timelines, e.g. "t" or "cr"
+  int parent;			// int(activity_type) of the parent category. 0 means a top-level category
+};
+
+// The activity taxonomy. Originally the codes, names and report labels of the activity types were hard-coded in four
+// separate switch statements (convert_c2a(), convert_a2c(), convert_a2s() and the report in main()). Now they are all
+// stored here, and a taxonomy file (count_times --taxonomy <file>) can add categories without modifying this program.
+// After the categories are set, compile() builds lookup tables so that reading a code in operator>>() is still one
+// table load:
+//  - single-character codes: a flat 256-entry table indexed by the character (both lower and upper cases are stored,
+//    so tolower() is not needed)
+//  - multi-character codes (e.g. "cr"): a perfect-hash table. compile() searches for a hash seed with which no two codes
+//    fall in the same slot, so lookup() needs only one hash computation and one string comparison.
+struct Taxonomy {
+  Taxonomy();			// set up the built-in categories
+
+  vector<Activity_category> categories; // index == int(activity_type). [0] is unused since not_set=1
+
+  void load(istream& is);	// read a taxonomy file. Throws runtime_error for a malformed line
+  void compile();		// (re)build the lookup tables below. Called after categories/codes are modified
+
+  activity_type lookup(char c) const {return code_table[(unsigned char)c];}
+  activity_type lookup(const string& code) const;
+  bool has_long_codes() const {return !long_codes.empty();}
+
+  int size() const {return categories.size();} // the size of a vector indexed by int(activity_type)
+  int find_id(const string& id) const;	       // index of the category with id, or 0 if not found
+
+private:
+  activity_type code_table[256];
+
+  vector<pair<string, activity_type>> long_codes; // all multi-character codes
+  vector<int> long_slots;	// perfect-hash slots. each element is an index of long_codes, or -1 for an empty slot
+  uint64_t seed;
+
+  uint64_t hash(const string& s) const {
+    // FNV-1a, mixed with the seed found in compile()
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for(unsigned char ch : s){
+      h ^= ch;
+      h *= 1099511628211ULL;
+    }
+    return h ^ (h >> 29);
+  }
+};
+
+Taxonomy::Taxonomy() : seed{0} {
+  struct Builtin {activity_type a; const char* id; const char* code; const char* name; const char* label;};
+  // the names and report labels are the same as the ones the old switch statements used
+  const Builtin builtins[] = {
+    {activity_type::not_set, "not_set", "n", "Not set", "not_set"},
+    {activity_type::task, "task", "t", "Task", "Task"},
+    {activity_type::wasteful, "wasteful", "w", "Wasteful activity", "wasteful activity"},
+    {activity_type::house_chore, "house_chore", "h", "House chores", "house chore"},
+    {activity_type::social, "social", "s", "Social activity", "social activity"},
+    {activity_type::write_log, "write_log", "l", "Write log", "log writing"},
+    {activity_type::miscellaneous, "miscellaneous", "m", "Miscellaneous", "miscellaneous activity"},
+    {activity_type::exercise, "exercise", "e", "Excercise", "exercise"},
+    {activity_type::travel, "travel", "d", "Travel", "travel"},
+    {activity_type::rest, "rest", "r", "Rest", "rest"},
+    {activity_type::pastime, "pastime", "p", "Pastime", "pastime"},
+    {activity_type::error, "error", "", "Activity type Error", "error"},
+    // 'z' (unknown) is not registered on purpose. Any unregistered code is read as activity_type::error.
+  };
+  categories.resize(int(activity_type::error)+1);
+  for(const Builtin& b : builtins){
+    Activity_category& cat = categories[int(b.a)];
+    cat.id = b.id; cat.name = b.name; cat.label = b.label; cat.parent = 0;
+    if(*b.code)
+      cat.codes.push_back(b.code);
+  }
+  compile();
+}
+
+int Taxonomy::find_id(const string& id) const {
+  for(int i=1; i<int(categories.size()); ++i)
+    if(categories[i].id == id)
+      return i;
+  return 0;
+}
+
+// Taxonomy file format (one category per line, '#' starts a comment):
+//   code  id  parent  label
+// e.g.
+//   cr  code_review  task  code review
+//   g   gaming       pastime
+//   c   social       -
+// - code: the code typed in timelines (case-insensitive). It may be longer than one character.
+// - id: if this is an existing id (e.g. "social"), the code is added to that category as another code.
+//   Otherwise, a new category is created.
+// - parent: id of the parent category, or '-'. In the report, the time of a child category is also added to its parent.
+// - label: the rest of the line. Used in the report "Total <label> time". When omitted, id is used.
+// If the code was already assigned to another category, it's moved to this category.
+void Taxonomy::load(istream& is){
+  string line;
+  int line_num{0};
+  while(getline(is, line)){
+    ++line_num;
+    size_t p = line.find('#');
+    if(p != string::npos)
+      line.erase(p);
+    istringstream iss{line};
+    string code, id, parent;
+    if(!(iss >> code))
+      continue;			// empty line or comment only
+    if(!(iss >> id >> parent))
+      throw runtime_error("Error in taxonomy file line " + to_string(line_num) + ": expected \"code id parent [label]\"");
+    for(char& ch : code){
+      if(!isalpha((unsigned char)ch))
+	throw runtime_error("Error in taxonomy file line " + to_string(line_num) + ": a code must consist of letters");
+      ch = tolower((unsigned char)ch);
+    }
+    string label;
+    getline(iss >> ws, label);
+    while(!label.empty() && isspace((unsigned char)label.back()))
+      label.pop_back();
+
+    int parent_i{0};
+    if(parent != "-"){
+      parent_i = find_id(parent);
+      if(parent_i == 0)
+	throw runtime_error("Error in taxonomy file line " + to_string(line_num) + ": unknown parent \"" + parent + "\"");
+    }
+
+    // remove the code from its old category
+    for(Activity_category& cat : categories)
+      for(size_t k=0; k<cat.codes.size(); ++k)
+	if(cat.codes[k] == code){
+	  cat.codes.erase(cat.codes.begin()+k);
+	  break;
+	}
+
+    int i = find_id(id);
+    if(i == 0){
+      Activity_category cat;
+      cat.id = id;
+      cat.label = label.empty() ? id : label;
+      cat.name = cat.label;
+      cat.parent = parent_i;
+      categories.push_back(cat);
+      i = categories.size()-1;
+    }
+    else{
+      if(!label.empty())
+	categories[i].label = label;
+      if(parent != "-")
+	categories[i].parent = parent_i;
+    }
+    if(parent_i >= i)
+      throw runtime_error("Error in taxonomy file line " + to_string(line_num) + ": the parent must be defined before its child");
+    // (this also prevents cycles, and the report in main() relies on this order)
+    categories[i].codes.push_back(code);
+  }
+  compile();
+}
+
+void Taxonomy::compile(){
+  for(activity_type& a : code_table)
+    a = activity_type::error;
+  long_codes.clear();
+
+  for(int i=1; i<int(categories.size()); ++i)
+    for(const string& code : categories[i].codes){
+      if(code.size() == 1){
+	code_table[(unsigned char)tolower((unsigned char)code[0])] = activity_type(i);
+	code_table[(unsigned char)toupper((unsigned char)code[0])] = activity_type(i);
+      }
+      else
+	long_codes.push_back({code, activity_type(i)});
+    }
+
+  long_slots.clear();
+  if(long_codes.empty())
+    return;
+
+  // search for a seed that maps every multi-character code to a distinct slot (perfect hashing).
+  // With a table twice as large as the number of codes, a few seeds are usually enough.
+  size_t n_slots{1};
+  while(n_slots < 2*long_codes.size())
+    n_slots <<= 1;
+  for(seed = 1; ; ++seed){
+    long_slots.assign(n_slots, -1);
+    bool collided{false};
+    for(size_t k=0; k<long_codes.size() && !collided; ++k){
+      int& slot = long_slots[hash(long_codes[k].first) & (n_slots-1)];
+      if(slot != -1)
+	collided = true;
+      slot = k;
+    }
+    if(!collided)
+      break;
+    if(seed % 1000 == 0)
+      n_slots <<= 1;		// too many failures. Let's give it more room.
+  }
+}
+
+activity_type Taxonomy::lookup(const string& code) const {
+  if(code.size() == 1)
+    return lookup(code[0]);
+  if(long_slots.empty())
+    return activity_type::error;
+  string lower{code};
+  for(char& ch : lower)
+    ch = tolower((unsigned char)ch);
+  int slot = long_slots[hash(lower) & (long_slots.size()-1)];
+  if(slot != -1 && long_codes[slot].first == lower)
+    return long_codes[slot].second;
+  return activity_type::error;
+}
+
+Taxonomy taxonomy;
+// the taxonomy used in this program. Like the global "date", made global for operator>>() to access it.
 
 // Let's define an abstract class for Timeline and sub_activity
 // The merits of defining this abstract class:
@@ -153,6 +429,14 @@ struct Sub_Timeline : Abst_Timeline {
   // To check if start_t is empty, I can check start_t.tm_mday is 0 or not.
   // ref: https://cboard.cprogramming.com/c-programming/179972-how-check-struct-tm-variable-empty.html
   // about memset(): https://cplusplus.com/reference/cstring/memset/
+  // -> instead of start_t, I keep all the time stamps of this sub-activity in spans, because one Sub_Timeline
+  //    aggregates all the parentheses of the same sub-activity in a timeline, e.g. "(s 12:20 - 12:30) ... (s 12:40 - 12:45)".
+  //    A duration-only one, e.g. (s ~20m), has no span.
+
+  // a time stamp pair of a sub-activity in minutes since 0:00, e.g. (s 12:20 - 12:30) -> {740, 750}.
+  // The date is not stored, as it's resolved later from the main activity's date (see resolve_sub_span()).
+  struct Span {int begin_min, end_min;};
+  vector<Span> spans;
 
   void print_subact(){
     cout << convert_a2s(a) << ", duration = " << duration << endl;
@@ -180,11 +464,17 @@ struct Timeline : Abst_Timeline {
   // -> So I made Abst_Timeline's copy constructor protected.
   // <- but when I do so, since derived classes' copy constructor is not deleted anymore, I don't need to explicitly
   //    define these copy constructor and assigment operator anymore.
-  Timeline(const Timeline& tl) : Abst_Timeline(tl), activity_content{tl.activity_content} {}
+  Timeline(const Timeline& tl) : Abst_Timeline(tl), activity_content{tl.activity_content}, subtl_vec{tl.subtl_vec} {}
   // Abst_Timeline(tl) uses Abst_Timeline's protected copy constructor. Since tl (Timeline) is a kind of Abst_Timeline,
   // passing a Timeline to Abst_Timeline doesn't generate an error.
+  // moving a Timeline (e.g. from a batch of parsed Timelines in the pipeline mode) doesn't copy the strings
+  Timeline(Timeline&&) = default;
+  Timeline& operator=(Timeline&&) = default;
   Timeline& operator=(const Timeline& tl){
-    end_t = tl.end_t; a = tl.a; activity_content = tl.activity_content;
+    Abst_Timeline::operator=(tl); // copies end_t, a, and task_num
+    activity_content = tl.activity_content; subtl_vec = tl.subtl_vec;
+    // subtl_vec (and task_num) were not copied before. It didn't matter while Timelines were only pushed back to tl_vec,
+    // but Ingest (below) reuses one Timeline by "cur = Timeline();", which must clear subtl_vec.
     return *this;
   }
 
@@ -195,6 +485,20 @@ struct Timeline : Abst_Timeline {
   // But this is just my current thought. Feel free to change it.
   const Sub_Timeline& get_subtl(int i){return subtl_vec[i];}
   int get_subtl_size(){return subtl_vec.size();}
+  const string& get_content() const {return activity_content;}
+
+  // shorten the sub-activities (from the last one) so that they total at most max_min minutes. Used when the
+  // timelines of several devices are merged and the interval of a timeline becomes shorter (see read_device_files())
+  void clip_subtl(long long max_min){
+    long long total{0};
+    for(const Sub_Timeline& s : subtl_vec)
+      total += s.duration;
+    for(size_t i=subtl_vec.size(); i-- > 0 && total > max_min; ){
+      long long cut = min<long long>(subtl_vec[i].duration, total - max_min);
+      subtl_vec[i].duration -= cut;
+      total -= cut;
+    }
+  }
   
 private:
   
@@ -383,7 +687,6 @@ istream& read_duration(istream& is, struct tm& t){
   
   for (auto it = begin; it != end; ++it) {
     match = *it;
-    cerr << "### match = " << match[0].str() << endl;
     if (match[1].matched && match[2].matched) {
       // Matched hours
       t.tm_hour = stoi(match[1].str());
@@ -418,7 +721,7 @@ istream& read_sub_timestamp(istream& is, Sub_Timeline& subtl){
     if(ct != '-'){
       cerr << "Error in reading the beginning/end time stamps of a sub-activity. The format is e.g. \"(~)19:20 - (~)20:15\"" << endl;
       cerr << "No following question marks are allowed, e.g. \"(~)19:20? - (~)20:15\"? will cause this error. " << endl;
-      cerr << "Also, check the hyphen. This program accepts only ASCII hyphen '-' (code 45), but your text might be using different hyphens like – (en-dash, code point 8211) or — (em-dash, code point 8212)" << endl;
+      cerr << "Also, check the hyphen. ASCII hyphen '-' and dashes like – (en-dash) or — (em-dash) are accepted (see normalize_utf8()), but other symbols are not" << endl;
       is.clear(ios_base::failbit);
       return is;
     }
@@ -458,6 +761,7 @@ istream& read_sub_timestamp(istream& is, Sub_Timeline& subtl){
     subtl.duration += seconds/60; // seconds/60 [minutes]
 
     subtl.end_t = e_tm; // this is not necessary, but just to store all available info
+    subtl.spans.push_back({b_tm.tm_hour*60 + b_tm.tm_min, e_tm.tm_hour*60 + e_tm.tm_min});
   }
   else if(read_duration(is, duration)){
     subtl.duration += duration.tm_hour*60;
@@ -469,132 +773,38 @@ istream& read_sub_timestamp(istream& is, Sub_Timeline& subtl){
 
 
 // helper function to convert activity_type to the corresponding char
+// (the first character of the first code of the category. 'z' for a category without any code, e.g. error)
 char convert_a2c(activity_type a){
-  switch(a){
-  case activity_type::wasteful:
-    return 'w';
-
-  case activity_type::task:
-    return 't';
-
-  case activity_type::miscellaneous:
-    return 'm';
-
-  case activity_type::house_chore:
-    return 'h';
-
-  case activity_type::social:
-    return 's';
-
-  case activity_type::write_log:
-    return 'l';
-
-  case activity_type::exercise:
-    return 'e';
-
-  case activity_type::rest:
-    return 'r';
-
-  case activity_type::travel:
-    return 't';
-
-  case activity_type::pastime:
-    return 'p';
-
-  case activity_type::not_set:
-    return 'n';
-
-  case activity_type::error:
-    return 'z';
-
-  default:
+  if(int(a) <= 0 || int(a) >= taxonomy.size())
     throw runtime_error("Error in convert_a2c(), unknown activity_type a is passed");
-  }
+  const vector<string>& codes = taxonomy.categories[int(a)].codes;
+  return codes.empty() ? 'z' : codes[0][0];
 }
 
 
 // helper function to convert a char to the corresponding activity_type
+// Both lower and upper case characters are accepted.
 activity_type convert_c2a(char c){
-  switch(c){
-  case 'w':
-    return activity_type::wasteful;
-
-  case 't':
-    return activity_type::task;
-
-  case 'm':
-    return activity_type::miscellaneous;
-
-  case 'h':
-    return activity_type::house_chore;
-
-  case 's':
-    return activity_type::social;
-
-  case 'l':
-    return activity_type::write_log;
-
-  case 'e':
-    return activity_type::exercise;
-
-  case 'r':
-    return activity_type::rest;
-
-  case 'd':
-    return activity_type::travel;
-
-  case 'p':
-    return activity_type::pastime;
-
-  case 'n':
-    return activity_type::not_set;
-  }
-
-  return activity_type::error;			// "error" represents an unknown activity type
+  return taxonomy.lookup(c); // activity_type::error represents an unknown activity type
 }
 
 // helper function to convert an activity type to a string (usually for debug)
 string convert_a2s(activity_type a){
-  switch(a){
-  case activity_type::wasteful:
-    return "Wasteful activity";
-
-  case activity_type::task:
-    return "Task";
-
-  case activity_type::miscellaneous:
-    return "Miscellaneous";
-
-  case activity_type::house_chore:
-    return "House chores";
-
-  case activity_type::social:
-    return "Social activity";
-
-  case activity_type::write_log:
-    return "Write log";
-
-  case activity_type::exercise:
-    return "Excercise";
-
-  case activity_type::rest:
-    return "Rest";
-
-  case activity_type::travel:
-    return "Travel";
-
-  case activity_type::pastime:
-    return "Pastime";
-
-  case activity_type::not_set:
-    return "Not set";
-
-  case activity_type::error:
-    return "Activity type Error";
-
-  default:
+  if(int(a) <= 0 || int(a) >= taxonomy.size())
     throw runtime_error("Error in convert_a2s(), unknown activity_type a is passed");
-  }
+  return taxonomy.categories[int(a)].name;
+}
+
+// Read an activity code from is, whose first character c has already been read, and return its activity_type.
+// When the taxonomy has multi-character codes (e.g. "cr"), the letters following c are also read as a part of the
+// code. Otherwise only c is used, the same way as the old convert_c2a(c), and nothing more is read from is.
+activity_type read_activity_code(istream& is, char c){
+  if(!taxonomy.has_long_codes() || !isalpha((unsigned char)is.peek()))
+    return convert_c2a(c);
+  string code(1, c);
+  while(isalpha((unsigned char)is.peek()))
+    code += char(is.get());
+  return taxonomy.lookup(code);
 }
 
 
@@ -817,6 +1027,57 @@ istream& get_task_num(istream& is, Abst_Timeline& t){
   return is;
 }
 
+// Journals repeat the same lines again and again ("- m 12:30 ate lunch", "- d 18:00 commuted (r ~10m)", ...), and
+// sections 2.5-4 of operator>>() below scan the content several times (and run a regex) for each of them. Their result,
+// the sub-activities and the main task digit, depends only on the content, the activity list before the time stamp
+// (e.g. "T+w") and the main task digit, not on the time stamp, so it's memoized per parser thread: the key is a hash
+// of these, and a hit is confirmed by comparing them (the content is kept once per distinct line, so the memo is also
+// the dictionary of the distinct contents). When the memo gets full, it's simply cleared.
+// (Sub_Timeline::end_t, set by read_sub_timestamp() with the date of the first occurrence, is not used anywhere.)
+class Parse_memo {
+public:
+  struct Key {
+    activity_type a;
+    int task_num;
+    vector<pair<activity_type, int>> listed; // the sub-activities in the activity list (type, task digit)
+  };
+  struct Value {
+    vector<Sub_Timeline> subtl_vec;
+    int task_num;
+  };
+
+  static uint64_t hash(const Key& k, const string& content){
+    uint64_t h = std::hash<string>{}(content);
+    auto mix = [&h](uint64_t v){h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);};
+    mix(uint64_t(k.a) << 8 | k.task_num);
+    for(const auto& p : k.listed)
+      mix(uint64_t(p.first) << 8 | p.second);
+    return h;
+  }
+  const Value* find(uint64_t h, const Key& k, const string& content) const {
+    auto it = entries.find(h);
+    if(it == entries.end() || it->second.content != content || it->second.key.a != k.a
+       || it->second.key.task_num != k.task_num || it->second.key.listed != k.listed)
+      return nullptr;
+    return &it->second.value;
+  }
+  void insert(uint64_t h, Key&& k, const string& content, const Value& v){
+    if(content.size() > max_content)
+      return;			// long lines rarely repeat
+    if(entries.size() >= max_entries)
+      entries.clear();
+    entries[h] = {move(k), content, v};
+  }
+
+private:
+  static const size_t max_entries = 1<<14;
+  static const size_t max_content = 256;
+  struct Entry {Key key; string content; Value value;};
+  unordered_map<uint64_t, Entry> entries;
+};
+
+thread_local Parse_memo parse_memo; // one per parser thread (--pipeline)
+
 // Define this operator overload outside the class, because if I define it inside
 // the class, the first argument is automatically determined to be Timeline (this) (implicit argument).
 // So I need to define this outside the class
@@ -866,6 +1127,7 @@ istream& operator>>(istream& is, Timeline& t){
     x
     y
     z - unknown (representing an error)
+    (this is the built-in taxonomy. More codes can be added with a taxonomy file. See Taxonomy::load())
   */
 
   // ####### section 1
@@ -873,7 +1135,7 @@ istream& operator>>(istream& is, Timeline& t){
   // If c is already a lowercase character, tolower() doesn't do anything.
   // ref: https://en.cppreference.com/w/cpp/string/byte/tolower
 
-  activity_type act = convert_c2a(c);
+  activity_type act = read_activity_code(is, c); // a multi-character code (e.g. "cr") is also read here, if any
   if(act == activity_type::error){
     cerr << "Error: Unknown activity type \'" << c << "\' is specified\n";
     is.clear(ios_base::failbit);
@@ -897,7 +1159,7 @@ istream& operator>>(istream& is, Timeline& t){
     c = tolower(c);
 
     // when '+' precedes, the next character must be one of activity type characters below
-    act = convert_c2a(c);
+    act = read_activity_code(is, c);
     if(act == activity_type::error){
       cerr << "Error: Unknown activity type \'" << c << "\' is specified\n";
       is.clear(ios_base::failbit);
@@ -911,7 +1173,8 @@ istream& operator>>(istream& is, Timeline& t){
       get_task_num(is, subtl); // This func. put back the next character if the following character is not the task digit,
       // including when the following digit character is for the time stamp e.g. - H+t 19:20
     }
-    t.subtl_vec.push_back(subtl); // using copy constructor/ assignment operator
+    if(parse_fields.subs)	// (with --main-only, the list is only skipped)
+      t.subtl_vec.push_back(subtl); // using copy constructor/ assignment operator
     //t.subtl_vec.push_back(Sub_Timeline(act));
     
     is >> c; // read the next '+'
@@ -931,23 +1194,51 @@ istream& operator>>(istream& is, Timeline& t){
   }
 
   // if the time stamp has a tailing '?', "is" has it at the front at this point.
+
+  if(!parse_fields.subs && !parse_fields.content && !(t.a == activity_type::task && t.task_num == 0))
+    return is;			// nothing after the time stamp is needed (--main-only)
   
   is >> ws;			// remove any whitespaces in the front
   // This time, this is necessary because getline() includes the front whitespaces without this is>>ws;
   
   // put the rest to activity_content, including whitespaces
-  getline(is, t.activity_content);
+  // (into a local string when the content is not kept. See Parse_fields)
+  string local_content;
+  string& content = parse_fields.content ? t.activity_content : local_content;
+  getline(is, content);
   // getline() reads until it hits a new line or char delim if you specify it
 
+  if(!parse_fields.subs){
+    // --main-only: only the main activity's task digit (section 4 below, without sub-activities and regex)
+    if(t.a == activity_type::task && t.task_num == 0)
+      for(size_t p = content.find("task "); p != string::npos; p = content.find("task ", p+1))
+	if(p+5 < content.size() && isdigit((unsigned char)content[p+5])){
+	  t.task_num = content[p+5] - '0';
+	  break;
+	}
+    return is;
+  }
+
+  // the same line as before (except the time stamp)? See Parse_memo
+  Parse_memo::Key memo_key{t.a, t.task_num, {}};
+  for(const Sub_Timeline& subtl : t.subtl_vec)
+    memo_key.listed.push_back({subtl.get_a(), subtl.task_num});
+  uint64_t memo_hash = Parse_memo::hash(memo_key, content);
+  if(const Parse_memo::Value* v = parse_memo.find(memo_hash, memo_key, content)){
+    t.subtl_vec = v->subtl_vec;
+    t.task_num = v->task_num;
+    return is;
+  }
+
   // ########## section 2.5
   // Search the activity_content and pick any forgotten sub-activities (sub-activities not listed in the first
   // activity list (e.g. "T+w") but existent in activity_content)
-  istringstream iss{t.activity_content};
+  istringstream iss{content};
   while(iss >> c){ // use the same way as section 3
     // check if this is a start of a sub-activity label.
     // e.g. (s ~20m), (t 19:00 - 19:20), (t1 18:15 - 18:30), ...
-    if(c == '(' && iss >> c && convert_c2a(c) != activity_type::error){      
-      activity_type act = convert_c2a(c);
+    activity_type act;
+    if(c == '(' && iss >> c && (act = read_activity_code(iss, c)) != activity_type::error){
       Sub_Timeline subtl(act); // at this point, it's not sure whether this is actually a sub-activity label
       
       if(act == activity_type::task){
@@ -978,7 +1269,7 @@ istream& operator>>(istream& is, Timeline& t){
   for(int i=0; i<t.subtl_vec.size(); ++i){
     char ct;
     activity_type at = t.subtl_vec[i].get_a(); // .get_a() returns a const reference. copy it to the local variable at.
-    istringstream iss{t.activity_content}; // to skip whitespaces simply, I put the string into istringstream
+    istringstream iss{content}; // to skip whitespaces simply, I put the string into istringstream
     Sub_Timeline subtl; // for a temporary storage of Sub_Timeline::task_num and Sub_Timeline::duration.
     // Do not modify t.tubtl_vec[i]'s duration and task_num yet, because at this point, this parentheses might not be
     // for a timestamp, i.e. we cannot know whether this parentheses is for example (test a program) or (t ~20m).
@@ -989,7 +1280,7 @@ istream& operator>>(istream& is, Timeline& t){
     while(iss >> ct){ // this automatically skips whitespaces
       // if there are some times like (w ~20m), they are aggregated.
 
-      if(ct == '(' && iss >> ct && convert_c2a(ct) == at){
+      if(ct == '(' && iss >> ct && read_activity_code(iss, ct) == at){
 	// Task digit type 3 (in the comments above get_task_num()'s definition)
 	Sub_Timeline subtl2; // just for fetching task_num in get_task_num
 	if(at == activity_type::task){
@@ -1013,7 +1304,7 @@ istream& operator>>(istream& is, Timeline& t){
 	  }
 	} // if(iss.get(ct) && isspace(ct)){
 	
-      } // if(ct == '(' && iss >> ct && convert_c2a(ct) == at){
+      } // if(ct == '(' && iss >> ct && read_activity_code(iss, ct) == at){
     } // while(iss >> ct){
 
     // at this point, all sub-activity timestamps are checked and Sub_Timeline::duration is stored.
@@ -1077,7 +1368,7 @@ istream& operator>>(istream& is, Timeline& t){
   // 2 in section 4 below, which is still incorrect).
   //
   // Obtain all "task \d" from t.activity_content with regex (see test_regex.cpp)
-  string s{t.activity_content};
+  string s{content};
   vector<int> task_num_vec;
   smatch m;
   regex pat{R"(task (\d))"};
@@ -1111,6 +1402,7 @@ istream& operator>>(istream& is, Timeline& t){
     }
   }
 
+  parse_memo.insert(memo_hash, move(memo_key), content, {t.subtl_vec, t.task_num});
   return is;
 }
 
@@ -1147,205 +1439,5620 @@ void Timeline::print_tl(){
 }
 
 
-int main(int argc, char** argv)
-try{
-  // test if I can instantiate Abst_Timeline (I should not be able to)
-  //Abst_Timeline at{};
-  // -> this line caused an error, as I expected
-  
-  if(argc < 2){
-    throw invalid_argument("Error: you need to specify the text file name with timelines");
+// ############################################################
+// UTF-8 normalization of input lines
+// ############################################################
+
+// The parser reads only ASCII, but dashes and full-width characters typed by an input method (e.g. "19:00 – 19:20"
+// with an en dash, or "（ｗ　～２０ｍ）") are easily mixed in, and then a line fails with a long error message.
+// normalize_utf8() maps them to ASCII in place before a line is parsed:
+//   U+2010-U+2015 (hyphens and dashes) and U+2212 (minus) -> '-'
+//   U+FF01-U+FF5E (full-width ASCII: digits, letters, ':', '(', ')', '~', ...) -> U+0021-U+007E
+//   U+3000 (ideographic space) -> ' ', U+301C (wave dash) -> '~'
+// Other characters are kept. Bytes not forming valid UTF-8 (overlong forms, surrogates, truncated sequences, ...) are
+// kept as they are, too: they can only be in activity contents, where they do no harm.
+// Almost all lines are ASCII only, so ASCII runs are skipped 16 bytes at a time with SSE2 (one compare per 16 bytes),
+// and such lines are not written at all.
+
+// the first index >= i of a non-ASCII byte in s[0, n), or n
+inline size_t skip_ascii(const char* s, size_t i, size_t n){
+#ifdef __SSE2__
+  for(; i+16 <= n; i += 16){
+    int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s+i))); // the top bit of each byte
+    if(mask)
+      return i + __builtin_ctz(mask);
   }
+#endif
+  for(; i<n; ++i)
+    if(static_cast<unsigned char>(s[i]) >= 0x80)
+      return i;
+  return n;
+}
 
-  string fname{argv[1]};
-  ifstream ifs{fname};
-  if(!ifs)
-    throw invalid_argument("Error: cannot open file " + fname);
-  
-  /* test Timeline's operator>>
-  Timeline tl;
-  string line;
-  int c{1};			// line count
-  while(getline(ifs, line)){
-    cout << "line " << c << endl;
-    istringstream iss{line};
-    iss >> tl;
-    tl.print_tl(); cout << endl;
-    ++c;
+// the ASCII character for code point cp, or 0 when it's kept
+inline char ascii_equivalent(uint32_t cp){
+  if((cp >= 0x2010 && cp <= 0x2015) || cp == 0x2212)
+    return '-';
+  if(cp >= 0xff01 && cp <= 0xff5e)
+    return char(cp - 0xfee0);
+  if(cp == 0x3000)
+    return ' ';
+  if(cp == 0x301c)
+    return '~';
+  return 0;
+}
+
+// the length of the valid UTF-8 sequence at s[i] (2-4) with its code point in cp, or 0 if it's not valid
+inline int decode_utf8(const char* s, size_t i, size_t n, uint32_t& cp){
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(s+i);
+  int len;
+  uint32_t lo{0x80};		// the smallest code point of len bytes (smaller ones are overlong forms)
+  if(u[0] >= 0xc2 && u[0] <= 0xdf){len = 2; cp = u[0] & 0x1f;}
+  else if(u[0] >= 0xe0 && u[0] <= 0xef){len = 3; cp = u[0] & 0x0f; lo = 0x800;}
+  else if(u[0] >= 0xf0 && u[0] <= 0xf4){len = 4; cp = u[0] & 0x07; lo = 0x10000;}
+  else
+    return 0;
+  if(i + len > n)
+    return 0;
+  for(int k=1; k<len; ++k){
+    if((u[k] & 0xc0) != 0x80)
+      return 0;
+    cp = cp << 6 | (u[k] & 0x3f);
   }
-  */
+  if(cp < lo || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    return 0;
+  return len;
+}
 
-  /* test Timeline(string s)
-  string line;
-  int c{1};			// line count
-  while(getline(ifs, line)){
-    cout << "line " << c << endl;
-    Timeline tl{line};
-    tl.print_tl(); cout << endl;
-    ++c;
+void normalize_utf8(string& line){
+  char* s = &line[0];
+  size_t n = line.size();
+  size_t r = skip_ascii(s, 0, n);
+  if(r == n)
+    return;			// ASCII only (the usual case)
+  size_t w = r;			// the characters are read at r and written at w (w <= r, as they only get shorter)
+  while(r < n){
+    size_t a = skip_ascii(s, r, n);
+    if(w != r)
+      memmove(s+w, s+r, a-r);
+    w += a-r;
+    r = a;
+    if(r == n)
+      break;
+    uint32_t cp;
+    int len = decode_utf8(s, r, n, cp);
+    if(!len){			// not valid UTF-8: keep the byte
+      s[w++] = s[r++];
+      continue;
+    }
+    if(char c = ascii_equivalent(cp)){
+      s[w++] = c;
+      r += len;
+    }
+    else{
+      memmove(s+w, s+r, len);
+      w += len;
+      r += len;
+    }
   }
-  */
+  line.resize(w);
+}
 
-  string line;
-  istringstream iss;
-  
-  // get the first line and read the date mm/dd/yyy
-  getline(ifs, line);
-  iss.str(line);
-  //tm date;			// std::tm
-  // for operator>>(istream& is, Timeline& t) to access the date info, I made date global
-  iss >> get_time(&date, "%m/%d/%Y");
-  // %m: 01-12. leading 0 is permitted but not required
-  if(iss.fail()){
-    cerr << "Error in reading the first line as a date\n";
-    cerr << "Required format: mm/dd/yyyy, e.g. 9/15/2025" << endl;
-    return 1;
+// ############################################################
+// Aggregation
+// ############################################################
+
+// A timeline whose time stamps are resolved to [begin, end) by Ingest.
+// The start of a main activity used to be only implicit (the previous timeline's end_t), and sub-activities were
+// reduced to minutes. Resolved_entry has them all as time_t (treated as UTC, see set_dates()).
+struct Resolved_entry {
+  const Timeline* tl;
+  time_t begin, end;		// the main activity's span (sub-activities are inside it)
+  long long main_min;		// minutes of the main activity after subtracting sub-activities
+  int line_num;			// the timeline number in the file (c in Ingest)
+
+  // a time-stamped sub-activity, e.g. (s 12:20 - 12:30). Duration-only sub-activities, e.g. (s ~20m), don't have it.
+  struct Sub_interval {activity_type a; int task_num; time_t begin, end;};
+  vector<Sub_interval> sub_intervals;
+};
+
+// functions called with every Resolved_entry (e.g. to build the interval index)
+using Entry_listener = function<void(const Resolved_entry&)>;
+
+// Resolve a sub-activity's time stamps (minutes since 0:00) to time_t. Sub-activity time stamps don't have a date, so
+// among the same times on the previous day, the day of the main activity's end, and the next day, the one nearest to
+// the main activity [b, e) is taken. e.g. for "- d 0:30 ... (h 23:40 - 23:55)", the sub-activity is on the previous
+// day of the main activity's end.
+pair<time_t, time_t> resolve_sub_span(const Sub_Timeline::Span& s, time_t b, time_t e){
+  time_t dur = ((s.end_min - s.begin_min) % 1440 + 1440) % 1440 * 60;
+  time_t day = (e >= 0 ? e/86400 : (e-86399)/86400) * 86400;
+  pair<time_t, time_t> best;
+  time_t best_gap{-1}, best_dist{0};
+  for(int d=-1; d<=1; ++d){
+    time_t se = day + d*86400 + s.end_min*60, sb = se - dur;
+    time_t gap = max<time_t>(0, max(b - se, sb - e)); // 0 when [sb, se) touches [b, e)
+    time_t dist = se > e ? se - e : e - se;
+    if(best_gap < 0 || gap < best_gap || (gap == best_gap && dist < best_dist)){
+      best = {sb, se};
+      best_gap = gap;
+      best_dist = dist;
+    }
   }
-  date.tm_hour = 0;
-  date.tm_min = 0;
-  date.tm_sec = 0;
-  // these pieces of info below date.tm_mday are not used, but to avoid any mistake when forwarding date by 1 day
-  // below (at if(e<b){...} in set_dates() function), I set them to 0.
-  
-  vector<Timeline> tl_vec;
-  int c{1}; // count the number of timelines
-  vector<int> record_act_time_vec(int(activity_type::error)+1, 0); // initialize all elements to 0
-  // To be able to specify the index by [int(activity_type)], I get an extra element +1
-  vector<int> record_task_time_vec(1,0); // record task times of each task. [0] record unclassified task time (task_num==0)
-  while(getline(ifs, line)){
-    iss.clear();		// clear the previous flags
-    iss.str(line);		// set a new line to istringstream
-    // ref: https://stackoverflow.com/questions/2767298/c-repeatedly-using-istringstream
-
-    tl_vec.push_back(Timeline()); // add an empty Timeline
-    if(!(iss >> tl_vec[tl_vec.size()-1])){ // check if iss is in good() condition. if(istream) checks if istream is in good()
-      cerr << "At " << c << "-th Timeline, an reading error happened\n";
-      return 1;
-    }
-    //tl_vec.push_back(tl);
-    // using the copy constructor of Timeline, copy the content of tl to a vector's element
-      
-    if(c > 1){			// calculate the number of minutes to pass from the last end time
-      time_t b, e;
-      tm *b_tm, *e_tm;		// used to create b and e of time_t
-      b_tm = &(tl_vec[c-2].end_t);
-      // Even though Abst_Timeline::get_tm() returns const struct tm&, b_tm (and e_tm) are non-const struct tm.
-      // Is this fine?
-      // -> yes, because b_tm is a copy of the referenced variable. Modifying b_tm doesn't change the original
-      //    variable of tl_vec[c-2].get_tm().
-      //tl_vec[c-2].get_tm().tm_year = 2000;
-      // <- this line caused an error as expected, since this tries to modify the const variable.
-      // So, modifying b_tm (e_tm) doesn't modify Timeline's end_t variable.
-      // -> this is not good, because b_tm/e_tm in this main function is the most up-to-date one
-      //    (correct year, month, and day are added). It's desirable for the Timeline objects to have
-      //    the correct date info, as well as hour and minute.
-      // -> So I changed b_tm/e_tm to a reference to end_t of the Timeline object, and update the year/month/day
-      //    (also changed the return type of Abst_Timeline::get_tm() from const struct tm& to struct tm&).
-      // -> If I do so, I can instead make end_t a public member and remove get_tm() function.
-      
-      e_tm = &(tl_vec[c-1].end_t); // tl_vec[c-1] is the same as tl_vec[tl_vec.size()-1]
-      date = set_dates(date, b_tm, e_tm); // update date if necessary
-      // when e_tm goes to the next day, update the global variable "date".
-      
-      //b = mktime(b_tm);
-      //e = mktime(e_tm);
-      b = timegm(b_tm); // UTC version of mktime(), to avoid setting tm_isdst flag
-      e = timegm(e_tm);
-      
-      double seconds = difftime(e, b);
-      //cout << "### Duration [min] = " << seconds/60 << endl;
-
-      // subtract sub-activities' durations from seconds and add them to record_act_time_vec
-      // Also, add task time
-      for(int i=0; i<tl_vec[c-1].get_subtl_size(); ++i){
-	const Sub_Timeline subtl = tl_vec[c-1].get_subtl(i);
-	seconds -= subtl.duration*60; // Sub_Timeline::duration is in minutes, so convert it to seconds
-	if(seconds < 0){
-	  cerr << "Error in subtracting sub-activity's duration from the main activity's duration." << endl;
-	  cerr << c << "-th Timeline, ";
-	  throw runtime_error("The main duration became negative");
-	}
-	record_act_time_vec[int(subtl.get_a())] += subtl.duration; // duration is in [minute], and store it in minutes
-	if(subtl.get_a() == activity_type::task){
-	  if(record_task_time_vec.size() < subtl.task_num+1)
-	    record_task_time_vec.resize(subtl.task_num+1, 0);
-	    // allocate a new memory of size (subtl.task_num+1), copy existing elements there, initialize new elements
-	    // with 0 (2nd argument), delete an old memory.
-	    // So the old elements remain in the resized array
-
-	  record_task_time_vec[subtl.task_num] += subtl.duration;
-	}
-      }
-      
-      record_act_time_vec[int(tl_vec[c-1].get_a())] += seconds/60; // store in minutes
-      if(tl_vec[c-1].get_a() == activity_type::task){
-	// This .resize() is necessary for the main activity as well.
-	// without this resize(), it tries to access unallocated address, which causes memory corruption error
-	if(record_task_time_vec.size() < tl_vec[c-1].task_num+1)
-	  record_task_time_vec.resize(tl_vec[c-1].task_num+1, 0);
-	
-	record_task_time_vec[tl_vec[c-1].task_num] += seconds/60;
-      }
+  return best;
+}
+
+// Call f(a, task_num, begin, end, stamped, sub) for each sub-activity span of re, where sub is the index of the
+// sub-activity in re.tl (e.g. for where_passes()). Time-stamped sub-activities have their own spans (stamped == true).
+// The rest of the sub-activities' minutes (e.g. (w ~20m)) have no time stamps, so they are laid out backwards from the
+// end of the main activity's span, in the order of the sub-activities.
+template<class F>
+void for_each_sub_span(const Resolved_entry& re, F f){
+  Timeline& t = const_cast<Timeline&>(*re.tl); // get_subtl() is not const (see Aggregate::add_entry())
+  vector<long long> stamped_min(t.get_subtl_size(), 0);
+  for(const Resolved_entry::Sub_interval& s : re.sub_intervals){
+    int i{0};			// (a span always comes from one of the sub-activities)
+    while(i+1 < t.get_subtl_size() && !(t.get_subtl(i).get_a() == s.a && t.get_subtl(i).task_num == s.task_num))
+      ++i;
+    f(s.a, s.task_num, s.begin, s.end, true, i);
+    stamped_min[i] += (s.end - s.begin)/60;
+  }
+  time_t cursor = re.end;
+  for(int i=0; i<t.get_subtl_size(); ++i){
+    long long rest = t.get_subtl(i).duration - stamped_min[i];
+    if(rest <= 0)
+      continue;
+    time_t b = max<time_t>(re.begin, cursor - rest*60);
+    f(t.get_subtl(i).get_a(), t.get_subtl(i).task_num, b, cursor, false, i);
+    cursor = b;
+  }
+}
+
+// ############################################################
+// Distribution sketches (--distribution)
+// ############################################################
+
+// KLL quantile sketch (Karnin, Lang and Liberty, "Optimal Quantile Approximation in Streams", 2016) for session
+// lengths in minutes. Values are kept in levels (compactors). A value in level h stands for 2^h original values.
+// When a level gets full, it's sorted and every other value (starting from a random offset) is moved up to the next
+// level, which halves the number of values and doubles their weight. Lower levels get smaller capacities (k*(2/3)^depth),
+// so the sketch keeps O(k) values no matter how many values are added, and the rank error is about 1.7/k.
+// Two sketches are merged by concatenating their levels and compacting again, so sketches of different files (or of
+// partial aggregates) can be combined.
+class Kll_sketch {
+public:
+  static const int k = 200;
+
+  Kll_sketch() : n{0}, rng_state{0x9e3779b97f4a7c15ULL} {levels.resize(1);}
+
+  void add(int v){
+    levels[0].push_back(v);
+    ++n;
+    if(levels[0].size() >= capacity(0))
+      compress();
+  }
+
+  void merge(const Kll_sketch& o){
+    if(levels.size() < o.levels.size())
+      levels.resize(o.levels.size());
+    for(size_t h=0; h<o.levels.size(); ++h)
+      levels[h].insert(levels[h].end(), o.levels[h].begin(), o.levels[h].end());
+    n += o.n;
+    compress();
+  }
+
+  // the value whose rank is about q*count() (0 <= q <= 1)
+  int quantile(double q) const;
+  uint64_t count() const {return n;}
+
+  void write(ostream& os) const;
+  void read(istream& is);
+
+private:
+  vector<vector<int>> levels;
+  uint64_t n;			// the number of values added
+  uint64_t rng_state;		// for the random offsets of compaction (fixed seed, so results are reproducible)
+
+  size_t capacity(size_t h) const {
+    size_t depth = levels.size() - 1 - h;
+    return max<size_t>(2, size_t(k * pow(2.0/3.0, depth)));
+  }
+  bool coin(){
+    rng_state ^= rng_state << 13; rng_state ^= rng_state >> 7; rng_state ^= rng_state << 17; // xorshift64
+    return rng_state & 1;
+  }
+  void compress();
+};
+
+void Kll_sketch::compress(){
+  for(size_t h=0; h<levels.size(); ++h){
+    if(levels[h].size() < capacity(h))
+      continue;
+    if(h+1 == levels.size())
+      levels.emplace_back();
+    vector<int>& cur = levels[h];
+    vector<int>& up = levels[h+1];
+    sort(cur.begin(), cur.end());
+    size_t m = cur.size() & ~size_t(1); // when the size is odd, the largest value stays in this level
+    for(size_t i=coin(); i<m; i+=2)
+      up.push_back(cur[i]);
+    cur.erase(cur.begin(), cur.begin()+m);
+  }
+}
+
+int Kll_sketch::quantile(double q) const {
+  vector<pair<int, uint64_t>> weighted;	// (value, weight)
+  uint64_t total{0};
+  for(size_t h=0; h<levels.size(); ++h)
+    for(int v : levels[h]){
+      weighted.push_back({v, uint64_t(1) << h});
+      total += uint64_t(1) << h;
     }
-    // for debug
-    //cout << "### " << c << "-th Timeline:" << endl;
-    //tl_vec[c-1].print_tl();
-    //cout << endl;
-    
-    ++c;
-  } // while(getline(ifs, line)){
+  if(weighted.empty())
+    return 0;
+  sort(weighted.begin(), weighted.end());
+  double target = q * total;
+  uint64_t cum{0};
+  for(const auto& w : weighted){
+    cum += w.second;
+    if(cum >= target)
+      return w.first;
+  }
+  return weighted.back().first;
+}
 
-  for(int i=1; i<=int(activity_type::rest); ++i){ // activity_type::not_set=1, so start with i=1
-    switch(i){
-    case int(activity_type::not_set):
-      cout << "Total not_set time: " << record_act_time_vec[int(activity_type::not_set)] << " [mins]" << endl;
-      break;
-      
-    case int(activity_type::task):
-      cout << "Total Task time: " << record_act_time_vec[int(activity_type::task)] << " [mins]" << endl;
-      cout << "\tUnclassified task time: " << record_task_time_vec[0] << " [mins]" << endl;
-      for(int i=1; i<record_task_time_vec.size(); ++i){
-	cout << "\tTask " << i << " time: " << record_task_time_vec[i] << " [mins]" << endl;
-      }
-      break;
+// Space-saving heavy hitters (Metwally, Agrawal and El Abbadi, 2005) for the most frequent content phrases.
+// It has a fixed number of counters. When a new phrase comes and all counters are used, the counter with the smallest
+// count is given to the new phrase, keeping the old count as the possible overcount (error). Any phrase occurring more
+// than (total/capacity) times is guaranteed to be kept.
+class Space_saving {
+public:
+  static const size_t capacity = 200;
 
-    case int(activity_type::wasteful):
-      cout << "Total wasteful activity time: " << record_act_time_vec[int(activity_type::wasteful)] << " [mins]" << endl;
-      break;
+  struct Counter {string item; long long count, error;};
 
-    case int(activity_type::house_chore):
-      cout << "Total house chore time: " << record_act_time_vec[int(activity_type::house_chore)] << " [mins]" << endl;
-      break;
+  void add(const string& item, long long w = 1);
+  void merge(const Space_saving& o);
+  vector<Counter> top(size_t n) const;	// the n largest counters
 
-    case int(activity_type::social):
-      cout << "Total social activity time: " << record_act_time_vec[int(activity_type::social)] << " [mins]" << endl;
-      break;
+  void write(ostream& os) const;
+  void read(istream& is);
 
-    case int(activity_type::write_log):
-      cout << "Total log writing time: " << record_act_time_vec[int(activity_type::write_log)] << " [mins]" << endl;
-      break;
+private:
+  vector<Counter> counters;
+  unordered_map<string, size_t> pos;	// item -> index in counters
+};
 
-    case int(activity_type::miscellaneous):
-      cout << "Total miscellaneous activity time: " << record_act_time_vec[int(activity_type::miscellaneous)] << " [mins]"  << endl;
-      break;
+void Space_saving::add(const string& item, long long w){
+  auto it = pos.find(item);
+  if(it != pos.end()){
+    counters[it->second].count += w;
+    return;
+  }
+  if(counters.size() < capacity){
+    pos[item] = counters.size();
+    counters.push_back({item, w, 0});
+    return;
+  }
+  size_t mi{0};
+  for(size_t i=1; i<counters.size(); ++i)
+    if(counters[i].count < counters[mi].count)
+      mi = i;
+  pos.erase(counters[mi].item);
+  pos[item] = mi;
+  counters[mi] = {item, counters[mi].count + w, counters[mi].count};
+}
 
-    case int(activity_type::exercise):
-      cout << "Total exercise time: " << record_act_time_vec[int(activity_type::exercise)] << " [mins]" << endl;
-      break;
+void Space_saving::merge(const Space_saving& o){
+  // A phrase missing from one summary may still have occurred there up to that summary's smallest count (when the
+  // summary is full). Add it as a possible overcount, then keep the largest counters (Agarwal et al., "Mergeable
+  // summaries", 2012).
+  auto min_count = [](const Space_saving& s){
+    if(s.counters.size() < capacity)
+      return 0LL;
+    long long m = s.counters[0].count;
+    for(const Counter& c : s.counters)
+      m = min(m, c.count);
+    return m;
+  };
+  long long my_min = min_count(*this), o_min = min_count(o);
+
+  unordered_map<string, Counter> all;
+  for(const Counter& c : counters)
+    all[c.item] = {c.item, c.count + o_min, c.error + o_min};
+  for(const Counter& c : o.counters){
+    auto it = all.find(c.item);
+    if(it != all.end()){
+      it->second.count += c.count - o_min;
+      it->second.error += c.error - o_min;
+    }
+    else
+      all[c.item] = {c.item, c.count + my_min, c.error + my_min};
+  }
+  vector<Counter> v;
+  for(auto& a : all)
+    v.push_back(a.second);
+  sort(v.begin(), v.end(), [](const Counter& x, const Counter& y){
+    return x.count > y.count || (x.count == y.count && x.item < y.item);
+  });
+  if(v.size() > capacity)
+    v.resize(capacity);
+  counters = v;
+  pos.clear();
+  for(size_t i=0; i<counters.size(); ++i)
+    pos[counters[i].item] = i;
+}
 
-    case int(activity_type::travel):
-      cout << "Total travel time: " << record_act_time_vec[int(activity_type::travel)] << " [mins]" << endl;
-      break;
+vector<Space_saving::Counter> Space_saving::top(size_t n) const {
+  vector<Counter> v{counters};
+  sort(v.begin(), v.end(), [](const Counter& x, const Counter& y){
+    return x.count > y.count || (x.count == y.count && x.item < y.item);
+  });
+  if(v.size() > n)
+    v.resize(n);
+  return v;
+}
 
-    case int(activity_type::rest):
-      cout << "Total rest time: " << record_act_time_vec[int(activity_type::rest)] << " [mins]" << endl;
+// the phrase of a timeline used for counting frequent phrases: the content up to the first '.', ',', '(' or "<-",
+// in lowercase with whitespaces collapsed, e.g. "did task 1 (unit tests). talked ..." -> "did task 1"
+string content_phrase(const string& content){
+  string s;
+  for(size_t i=0; i<content.size() && s.size() < 40; ++i){
+    char ch = content[i];
+    if(ch == '.' || ch == ',' || ch == '(' || (ch == '<' && i+1 < content.size() && content[i+1] == '-'))
       break;
+    if(isspace((unsigned char)ch)){
+      if(!s.empty() && s.back() != ' ')
+	s += ' ';
+    }
+    else
+      s += tolower((unsigned char)ch);
+  }
+  while(!s.empty() && s.back() == ' ')
+    s.pop_back();
+  return s;
+}
 
-    case int(activity_type::pastime):
-      cout << "Total rest time: " << record_act_time_vec[int(activity_type::pastime)] << " [mins]" << endl;
-      break;
+// one of the longest activity blocks
+struct Long_block {
+  long long min;
+  time_t end;
+  activity_type a;
+  int task_num;
+  string phrase;
+};
+
+// the order of Long_blocks: longer first, then earlier first
+bool longer_block(const Long_block& x, const Long_block& y){
+  return x.min > y.min || (x.min == y.min && x.end < y.end);
+}
+
+// Session-length distributions, the longest blocks and the frequent phrases. They are kept in Aggregate (only when
+// Aggregate::with_sketches is true) and use fixed memory however many timelines are read.
+struct Sketches {
+  static const size_t n_longest = 20;
+
+  vector<Kll_sketch> session_min;	// [int(activity_type)]. Lengths of main activity blocks and sub-activities
+  vector<Long_block> longest;		// a min-heap (by longer_block) of the n_longest longest main activity blocks
+  Space_saving phrases;
+
+  void add_session(activity_type a, long long min){
+    if(min <= 0)
+      return;
+    if(int(session_min.size()) <= int(a))
+      session_min.resize(int(a)+1);
+    session_min[int(a)].add(min);
+  }
+  void add_block(const Long_block& b){
+    if(longest.size() < n_longest){
+      longest.push_back(b);
+      push_heap(longest.begin(), longest.end(), longer_block);
+    }
+    else if(longer_block(b, longest.front())){
+      pop_heap(longest.begin(), longest.end(), longer_block);
+      longest.back() = b;
+      push_heap(longest.begin(), longest.end(), longer_block);
+    }
+  }
+  void merge(const Sketches& o){
+    if(session_min.size() < o.session_min.size())
+      session_min.resize(o.session_min.size());
+    for(size_t i=0; i<o.session_min.size(); ++i)
+      session_min[i].merge(o.session_min[i]);
+    for(const Long_block& b : o.longest)
+      add_block(b);
+    phrases.merge(o.phrases);
+  }
+};
+
+// ############################################################
+// Row filter (--where)
+// ############################################################
+
+// A row is what Aggregate adds: the main activity of a timeline or one of its sub-activities. Both have the time
+// stamp (end time) and the content of the timeline.
+struct Row {
+  time_t end;
+  activity_type a;
+  int task_num;
+  long long min;
+  bool sub;
+  const string* content;
+};
+
+// A --where expression, e.g.
+//   type in (t,s) and task=3 and hour>=9 and day in Mon..Fri and content~"meeting"
+// It's parsed once (recursive descent) and compiled to a flat program in postfix order, e.g. "a and (b or not c)"
+// becomes [a, b, c, not, or, and], which is run over a small bool stack for every row. There is no tree to follow and
+// no allocation per row, so a filtered run costs little more than an unfiltered one (parsing a timeline costs far more).
+//
+// Fields:
+//   type    activity code or id (a category also matches its child categories). =, !=, in (x, y, ...)
+//	     (in takes a single item or range without parentheses, too)
+//   task    task digit		   (numeric fields take =, !=, <, <=, >, >= and in (v, v..v, ...))
+//   hour    hour of the time stamp (0-23)
+//   day     day of the week of the time stamp (Sun, Mon, ..., Sat. Mon..Fri is a range)
+//   date    date of the time stamp (yyyy-mm-dd)
+//   min     minutes of the row
+//   content ~ "text", !~ "text": whether the timeline's content contains text (case-insensitive)
+//   sub, main: the row is a sub-activity / the main activity
+// combined with and, or, not and parentheses.
+class Where_filter {
+public:
+  explicit Where_filter(const string& expr); // throws invalid_argument for a syntax error
+  bool operator()(const Row& r) const;
+  bool uses_content() const;	// whether the expression reads the content (see Parse_fields)
+
+private:
+  enum class Op {num_in, type_in, content_has, is_sub, op_and, op_or, op_not};
+  enum class Field {task, hour, day, date, min};
+  struct Instr {
+    Op op;
+    Field field{Field::task};
+    vector<pair<long long, long long>> ranges{}; // num_in: the value is in one of [first, second]
+    vector<char> types{};			 // type_in: [int(activity_type)]
+    string text{};				 // content_has: in lowercase
+  };
+  vector<Instr> prog;
+  static const int max_depth = 64;	// of the bool stack
+
+  // parser
+  vector<string> tokens;
+  size_t pos{0};
+  void tokenize(const string& expr);
+  const string& peek() const {static const string end; return pos < tokens.size() ? tokens[pos] : end;}
+  string next();
+  void expect(const string& tok);
+  void parse_or();
+  void parse_and();
+  void parse_unary();
+  void parse_term();
+  long long parse_value(Field f, const string& tok) const;
+  [[noreturn]] void fail(const string& msg) const {
+    throw invalid_argument("Error in --where: " + msg);
+  }
+};
+
+Where_filter::Where_filter(const string& expr){
+  tokenize(expr);
+  if(tokens.empty())
+    fail("empty expression");
+  parse_or();
+  if(pos < tokens.size())
+    fail("unexpected \"" + tokens[pos] + "\"");
+  // check the stack depth once here, so that operator()() doesn't have to
+  int depth{0};
+  for(const Instr& in : prog){
+    if(in.op == Op::op_and || in.op == Op::op_or)
+      --depth;
+    else if(in.op != Op::op_not)
+      ++depth;
+    if(depth > max_depth)
+      fail("too deeply nested");
+  }
+  tokens.clear();
+}
+
+void Where_filter::tokenize(const string& expr){
+  for(size_t i=0; i<expr.size(); ){
+    unsigned char ch = expr[i];
+    if(isspace(ch))
+      ++i;
+    else if(ch == '"'){
+      size_t j = expr.find('"', i+1);
+      if(j == string::npos)
+	fail("missing closing \"");
+      tokens.push_back(expr.substr(i, j-i+1)); // with the quotes, to distinguish it from words
+      i = j+1;
     }
+    else if(isalnum(ch) || ch == '_' || ch == '-'){
+      size_t j{i};
+      while(j < expr.size() && (isalnum((unsigned char)expr[j]) || expr[j] == '_' || expr[j] == '-'))
+	++j;
+      tokens.push_back(expr.substr(i, j-i));
+      i = j;
+    }
+    else{
+      // operators. two-character ones first
+      string two = expr.substr(i, 2);
+      if(two == "!=" || two == "<=" || two == ">=" || two == "!~" || two == ".."){
+	tokens.push_back(two);
+	i += 2;
+      }
+      else if(string("=<>~(),").find(ch) != string::npos){
+	tokens.push_back(string(1, ch));
+	++i;
+      }
+      else
+	fail(string("unexpected character '") + char(ch) + "'");
+    }
+  }
+}
+
+string Where_filter::next(){
+  if(pos == tokens.size())
+    fail("unexpected end of the expression");
+  return tokens[pos++];
+}
+
+void Where_filter::expect(const string& tok){
+  if(next() != tok)
+    fail("\"" + tok + "\" is expected before \"" + tokens[pos-1] + "\"");
+}
+
+void Where_filter::parse_or(){
+  parse_and();
+  while(peek() == "or"){
+    ++pos;
+    parse_and();
+    prog.push_back({Op::op_or});
+  }
+}
+
+void Where_filter::parse_and(){
+  parse_unary();
+  while(peek() == "and"){
+    ++pos;
+    parse_unary();
+    prog.push_back({Op::op_and});
+  }
+}
+
+void Where_filter::parse_unary(){
+  if(peek() == "not"){
+    ++pos;
+    parse_unary();
+    prog.push_back({Op::op_not});
+  }
+  else if(peek() == "("){
+    ++pos;
+    parse_or();
+    expect(")");
+  }
+  else
+    parse_term();
+}
+
+long long Where_filter::parse_value(Field f, const string& tok) const {
+  if(f == Field::day){
+    static const char* names[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+    string t;
+    for(char ch : tok.substr(0, 3))
+      t += tolower((unsigned char)ch);
+    for(int d=0; d<7; ++d)
+      if(tok.size() >= 3 && t == names[d])
+	return d;
+    fail("unknown day \"" + tok + "\" (Sun, Mon, ..., Sat)");
+  }
+  if(f == Field::date){
+    istringstream iss{tok};
+    tm t{};
+    iss >> get_time(&t, "%Y-%m-%d");
+    if(iss.fail())
+      fail("a date must be yyyy-mm-dd, not \"" + tok + "\"");
+    return timegm(&t) / 86400;
+  }
+  try{
+    size_t n;
+    long long v = stoll(tok, &n);
+    if(n == tok.size())
+      return v;
   }
+  catch(exception&){
+  }
+  fail("a number is expected, not \"" + tok + "\"");
+}
+
+void Where_filter::parse_term(){
+  string name = next();
+  if(name == "sub" || name == "main"){
+    prog.push_back({Op::is_sub});
+    if(name == "main")
+      prog.push_back({Op::op_not});
+    return;
+  }
+
+  if(name == "content"){
+    string op = next();
+    string text = next();
+    if((op != "~" && op != "!~") || text.size() < 2 || text[0] != '"')
+      fail("content takes ~ \"text\" or !~ \"text\"");
+    Instr in{Op::content_has};
+    for(size_t i=1; i+1<text.size(); ++i)
+      in.text += tolower((unsigned char)text[i]);
+    prog.push_back(in);
+    if(op == "!~")
+      prog.push_back({Op::op_not});
+    return;
+  }
+
+  if(name == "type"){
+    Instr in{Op::type_in};
+    in.types.assign(taxonomy.size(), 0);
+    auto add_type = [&](const string& tok){
+      int k = taxonomy.find_id(tok);
+      if(k == 0){
+	activity_type a = taxonomy.lookup(tok);
+	if(a == activity_type::error)
+	  fail("unknown activity type \"" + tok + "\"");
+	k = int(a);
+      }
+      // the category and its descendants (a parent always comes before its children in taxonomy.categories)
+      in.types[k] = 1;
+      for(int i=k+1; i<taxonomy.size(); ++i)
+	if(taxonomy.categories[i].parent && in.types[taxonomy.categories[i].parent])
+	  in.types[i] = 1;
+    };
+    string op = next();
+    if(op == "=" || op == "!=")
+      add_type(next());
+    else if(op == "in"){
+      bool paren = peek() == "(" && ++pos; // a single item doesn't need parentheses
+      do
+	add_type(next());
+      while(paren && peek() == "," && ++pos);
+      if(paren)
+	expect(")");
+    }
+    else
+      fail("type takes =, != or in (...)");
+    prog.push_back(in);
+    if(op == "!=")
+      prog.push_back({Op::op_not});
+    return;
+  }
+
+  Field f;
+  if(name == "task") f = Field::task;
+  else if(name == "hour") f = Field::hour;
+  else if(name == "day") f = Field::day;
+  else if(name == "date") f = Field::date;
+  else if(name == "min") f = Field::min;
+  else
+    fail("unknown field \"" + name + "\"");
+
+  // every comparison becomes a set of ranges, e.g. hour>=9 -> [9, max], day in Fri..Mon -> [5, 6], [0, 1]
+  const long long lo = numeric_limits<long long>::min(), hi = numeric_limits<long long>::max();
+  Instr in{Op::num_in, f};
+  string op = next();
+  bool negate{op == "!="};
+  if(op == "in"){
+    bool paren = peek() == "(" && ++pos; // a single item or range (e.g. day in Mon..Fri) doesn't need parentheses
+    do{
+      long long a = parse_value(f, next()), b{a};
+      if(peek() == ".."){
+	++pos;
+	b = parse_value(f, next());
+      }
+      if(a <= b)
+	in.ranges.push_back({a, b});
+      else if(f == Field::day){ // a range over the weekend
+	in.ranges.push_back({a, 6});
+	in.ranges.push_back({0, b});
+      }
+      else
+	fail("empty range");
+    } while(paren && peek() == "," && ++pos);
+    if(paren)
+      expect(")");
+  }
+  else{
+    long long v = parse_value(f, next());
+    if(op == "=" || op == "!=") in.ranges.push_back({v, v});
+    else if(op == "<") in.ranges.push_back({lo, v-1});
+    else if(op == "<=") in.ranges.push_back({lo, v});
+    else if(op == ">") in.ranges.push_back({v+1, hi});
+    else if(op == ">=") in.ranges.push_back({v, hi});
+    else
+      fail("\"" + op + "\" cannot be used for " + name);
+  }
+  prog.push_back(in);
+  if(negate)
+    prog.push_back({Op::op_not});
+}
+
+bool Where_filter::uses_content() const {
+  return any_of(prog.begin(), prog.end(), [](const Instr& in){return in.op == Op::content_has;});
+}
+
+bool Where_filter::operator()(const Row& r) const {
+  bool stack[max_depth];
+  int sp{0};
+  for(const Instr& in : prog){
+    switch(in.op){
+    case Op::num_in:{
+      long long v;
+      long long day = r.end >= 0 ? r.end/86400 : (r.end-86399)/86400;
+      switch(in.field){
+      case Field::task: v = r.task_num; break;
+      case Field::hour: v = (r.end - day*86400) / 3600; break;
+      case Field::day: v = ((day + 4) % 7 + 7) % 7; break; // 1970-01-01 was a Thursday
+      case Field::date: v = day; break;
+      default: v = r.min; break;
+      }
+      bool b{false};
+      for(const auto& rg : in.ranges)
+	b = b || (rg.first <= v && v <= rg.second);
+      stack[sp++] = b;
+      break;
+    }
+    case Op::type_in:
+      stack[sp++] = int(r.a) < int(in.types.size()) && in.types[int(r.a)];
+      break;
+    case Op::content_has:
+      stack[sp++] = search(r.content->begin(), r.content->end(), in.text.begin(), in.text.end(),
+			   [](char x, char y){return tolower((unsigned char)x) == y;}) != r.content->end();
+      break;
+    case Op::is_sub:
+      stack[sp++] = r.sub;
+      break;
+    case Op::op_and:
+      --sp;
+      stack[sp-1] = stack[sp-1] && stack[sp];
+      break;
+    case Op::op_or:
+      --sp;
+      stack[sp-1] = stack[sp-1] || stack[sp];
+      break;
+    case Op::op_not:
+      stack[sp-1] = !stack[sp-1];
+      break;
+    }
+  }
+  return stack[0];
+}
+
+// whether a row of re passes where (nullptr: no filter), with the same values as Aggregate::add_entry(): the main
+// activity (sub < 0) with its minutes without sub-activities, or the sub-th sub-activity with its duration
+bool where_passes(const Where_filter* where, const Resolved_entry& re, int sub){
+  if(!where)
+    return true;
+  Timeline& t = const_cast<Timeline&>(*re.tl); // get_subtl() is not const (see Aggregate::add_entry())
+  if(sub < 0)
+    return (*where)({re.end, t.get_a(), t.task_num, re.main_min, false, &t.get_content()});
+  const Sub_Timeline& subtl = t.get_subtl(sub);
+  return (*where)({re.end, subtl.get_a(), subtl.task_num, subtl.duration, true, &t.get_content()});
+}
+
+class Dedup_set;		// see below Aggregate
+
+// Aggregated times of timelines. All times are in minutes.
+// This used to be record_act_time_vec and record_task_time_vec local to main(). I made them a struct so that the
+// aggregate of one run can be written to a file (--emit-partial) and merged with the aggregates of other runs
+// (count_times merge ...) without re-parsing the timeline files.
+struct Aggregate {
+  Aggregate() : act_min(taxonomy.size(), 0), task_min(1, 0), has_entries{false}, first_t{0}, last_t{0},
+		first_a{activity_type::not_set}, first_task{0} {}
+
+  vector<long long> act_min;	// [int(activity_type)]
+  vector<long long> task_min;	// [task_num]. [0] records unclassified task time (task_num==0)
+  map<long long, vector<long long>> day_min;
+  // per-day breakdown. key: days since 1970-01-01 (of the end time of a timeline), value: minutes per activity_type
+
+  // The boundary of the aggregated timelines, needed to stitch adjacent shards (e.g. the same timeline file split
+  // into two). The first timeline of a file is only the starting point of time count, so its own interval is not
+  // counted. When the shard before it is known, that interval (from the previous shard's last_t to first_t) can be
+  // counted with first_a, first_task and first_subs.
+  bool has_entries;
+  time_t first_t, last_t;	// end times of the first/last timelines
+  activity_type first_a;
+  int first_task;
+  bool first_counted{true};	// false when the main activity of the first timeline is excluded by --where
+  struct Sub_minutes {activity_type a; int task_num; long long min; bool counted{true};};
+  vector<Sub_minutes> first_subs; // sub-activities of the first timeline
+
+  // --where: only the rows (a main activity or a sub-activity) passing this filter are added. nullptr: all rows
+  const Where_filter* where{nullptr};
+  // --dedup: Ingest skips the timelines already in this set (shared by the input files). nullptr: no dedup
+  Dedup_set* dedup{nullptr};
+  // --from/--to: the timelines ending outside [from, to) are not passed to Ingest's listeners, so that their outputs
+  // are the same whether or not a date index skips the other days. (The rows of this Aggregate are filtered by where,
+  // which has the same range.)
+  time_t from{numeric_limits<time_t>::min()}, to{numeric_limits<time_t>::max()};
+
+  // Distributions of session lengths, the longest blocks and the most time-consuming phrases (--distribution).
+  // They are updated in add_entry(), i.e. in the same pass as the totals above, only when with_sketches is true.
+  bool with_sketches{false};
+  Sketches sketches;
+
+  void add(activity_type a, int task_num, long long min, time_t end);
+  void add_entry(const Timeline& tl, long long main_min, time_t end); // main_min: after subtracting sub-activities
+  void note_timeline(const Timeline& tl, time_t end);	       // update first_*/last_t
+
+  // Merge b into this. The result doesn't depend on the order of merges (merge is associative and commutative),
+  // except with stitch=true, where b must be the shard that follows this in time.
+  void merge(const Aggregate& b, bool stitch = false);
+};
+
+void Aggregate::add(activity_type a, int task_num, long long min, time_t end){
+  if(int(act_min.size()) <= int(a))
+    act_min.resize(int(a)+1, 0);
+  act_min[int(a)] += min;
+  if(a == activity_type::task){
+    if(int(task_min.size()) < task_num+1)
+      task_min.resize(task_num+1, 0);
+    // allocate a new memory of size (task_num+1), copy existing elements there, initialize new elements
+    // with 0 (2nd argument), delete an old memory.
+    // So the old elements remain in the resized array
+    task_min[task_num] += min;
+  }
+  vector<long long>& day = day_min[end >= 0 ? end/86400 : (end-86399)/86400];
+  if(int(day.size()) <= int(a))
+    day.resize(int(a)+1, 0);
+  day[int(a)] += min;
+}
+
+void Aggregate::add_entry(const Timeline& tl, long long main_min, time_t end){
+  // (Timeline's get_subtl() and get_subtl_size() are not const, so I cast the constness away here. They don't modify tl)
+  Timeline& t = const_cast<Timeline&>(tl);
+  for(int i=0; i<t.get_subtl_size(); ++i){
+    const Sub_Timeline& subtl = t.get_subtl(i);
+    if(where && !(*where)({end, subtl.get_a(), subtl.task_num, subtl.duration, true, &tl.get_content()}))
+      continue;
+    add(subtl.get_a(), subtl.task_num, subtl.duration, end); // duration is in [minute], and store it in minutes
+    if(with_sketches)
+      sketches.add_session(subtl.get_a(), subtl.duration);
+  }
+  if(where && !(*where)({end, tl.get_a(), tl.task_num, main_min, false, &tl.get_content()}))
+    return;
+  add(tl.get_a(), tl.task_num, main_min, end);
+  if(with_sketches){
+    string phrase = content_phrase(tl.get_content());
+    sketches.add_session(tl.get_a(), main_min);
+    sketches.add_block({main_min, end, tl.get_a(), tl.task_num, phrase});
+    if(!phrase.empty() && main_min > 0)
+      sketches.phrases.add(phrase, main_min);
+  }
+}
+
+void Aggregate::note_timeline(const Timeline& tl, time_t end){
+  if(!has_entries || end < first_t){
+    Timeline& t = const_cast<Timeline&>(tl);
+    first_t = end;
+    first_a = tl.get_a();
+    first_task = tl.task_num;
+    first_subs.clear();
+    for(int i=0; i<t.get_subtl_size(); ++i){
+      const Sub_Timeline& subtl = t.get_subtl(i);
+      bool counted = !where || (*where)({end, subtl.get_a(), subtl.task_num, subtl.duration, true, &tl.get_content()});
+      first_subs.push_back({subtl.get_a(), subtl.task_num, subtl.duration, counted});
+    }
+    // (the main activity's minutes are not known until stitching, so a --where on min sees 0 here)
+    first_counted = !where || (*where)({end, tl.get_a(), tl.task_num, 0, false, &tl.get_content()});
+  }
+  if(!has_entries || end > last_t)
+    last_t = end;
+  has_entries = true;
+}
+
+void Aggregate::merge(const Aggregate& b, bool stitch){
+  if(stitch && has_entries && b.has_entries && last_t <= b.first_t){
+    // count b's first timeline, whose interval starts at our last timeline
+    long long main_min = (b.first_t - last_t)/60;
+    for(const Sub_minutes& s : b.first_subs){
+      main_min -= s.min;
+      if(!s.counted)
+	continue;
+      add(s.a, s.task_num, s.min, b.first_t);
+      if(with_sketches)
+	sketches.add_session(s.a, s.min);
+    }
+    if(main_min < 0)
+      throw runtime_error("Error in stitching partial aggregates: the main duration became negative");
+    if(b.first_counted)
+      add(b.first_a, b.first_task, main_min, b.first_t);
+    if(with_sketches && b.first_counted){
+      // (the content of the first timeline is not kept in partials, so this block has no phrase)
+      sketches.add_session(b.first_a, main_min);
+      sketches.add_block({main_min, b.first_t, b.first_a, b.first_task, ""});
+    }
+  }
+
+  for(int i=0; i<int(b.act_min.size()); ++i){
+    if(b.act_min[i] == 0)
+      continue;
+    if(int(act_min.size()) <= i)
+      act_min.resize(i+1, 0);
+    act_min[i] += b.act_min[i];
+  }
+  if(task_min.size() < b.task_min.size())
+    task_min.resize(b.task_min.size(), 0);
+  for(size_t i=0; i<b.task_min.size(); ++i)
+    task_min[i] += b.task_min[i];
+  for(const auto& d : b.day_min){
+    vector<long long>& day = day_min[d.first];
+    if(day.size() < d.second.size())
+      day.resize(d.second.size(), 0);
+    for(size_t i=0; i<d.second.size(); ++i)
+      day[i] += d.second[i];
+  }
+  if(b.with_sketches){
+    sketches.merge(b.sketches);
+    with_sketches = true;
+  }
+
+  if(!b.has_entries)
+    return;
+  if(!has_entries || b.first_t < first_t){
+    first_t = b.first_t; first_a = b.first_a; first_task = b.first_task; first_subs = b.first_subs;
+    first_counted = b.first_counted;
+  }
+  if(!has_entries || b.last_t > last_t)
+    last_t = b.last_t;
+  has_entries = true;
+}
+
+// A set of timeline hashes to skip the timelines already counted (--dedup), e.g. when exports of a timeline overlap
+// and the same lines are in several files.
+// It's an open-addressing hash table (linear probing) of 64-bit hashes and the end times, so a lookup touches one or
+// two cache lines. With a window, the timelines ending more than the window before the latest one are dropped when
+// the table grows, so the memory stays bounded by the number of timelines in the window (the overlaps of exports are
+// usually near in time).
+class Dedup_set {
+public:
+  explicit Dedup_set(time_t window_sec = 0) : window{window_sec} {rehash(1024);}
+
+  bool insert(uint64_t h, time_t end); // false if h is already in the set
+  int n_skipped{0};		       // the number of timelines skipped as duplicates
+
+private:
+  struct Slot {uint64_t h; time_t end;}; // h == 0: empty
+  vector<Slot> slots;
+  size_t n{0};
+  time_t window;		// 0: no window
+  time_t max_end{numeric_limits<time_t>::min()};
+
+  void rehash(size_t cap);
+};
+
+bool Dedup_set::insert(uint64_t h, time_t end){
+  if(h == 0)
+    h = 1;			// 0 marks an empty slot
+  max_end = max(max_end, end);
+  size_t mask = slots.size() - 1;
+  for(size_t i = h & mask; ; i = (i+1) & mask){
+    if(slots[i].h == h)
+      return false;
+    if(slots[i].h == 0){
+      slots[i] = {h, end};
+      if(++n * 4 > slots.size() * 3) // keep the load factor below 3/4
+	rehash(slots.size());
+      return true;
+    }
+  }
+}
+
+void Dedup_set::rehash(size_t cap){
+  vector<Slot> old;
+  old.swap(slots);
+  size_t live{0};
+  for(const Slot& s : old)
+    if(s.h && (!window || s.end >= max_end - window))
+      ++live;
+  while(live * 2 > cap)		// after dropping old ones, grow only if the table is still half full
+    cap *= 2;
+  slots.assign(cap, {0, 0});
+  n = 0;
+  for(const Slot& s : old)
+    if(s.h && (!window || s.end >= max_end - window)){
+      size_t i = s.h & (cap - 1);
+      while(slots[i].h)
+	i = (i+1) & (cap - 1);
+      slots[i] = s;
+      ++n;
+    }
+}
+
+// the key of a timeline for Dedup_set: a 64-bit hash of its end time, activity type, task, sub-activities (type, task
+// and minutes of each, so "h+s" and "h" are different timelines) and content (whitespace runs are regarded as one
+// space, and leading/trailing ones are ignored)
+uint64_t timeline_hash(const Timeline& tl, time_t end){
+  uint64_t h = 14695981039346656037ULL; // FNV-1a
+  bool space{false};
+  for(char ch : tl.get_content()){
+    if(isspace((unsigned char)ch)){
+      space = true;
+      continue;
+    }
+    if(space && h != 14695981039346656037ULL){
+      h ^= ' ';
+      h *= 1099511628211ULL;
+    }
+    space = false;
+    h ^= (unsigned char)ch;
+    h *= 1099511628211ULL;
+  }
+  // mix in the rest (splitmix64 finalizer)
+  auto mix = [&h](uint64_t v){
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+  };
+  for(uint64_t v : {uint64_t(end), uint64_t(tl.get_a()), uint64_t(tl.task_num)})
+    mix(v);
+  Timeline& t = const_cast<Timeline&>(tl); // get_subtl() is not const (see Aggregate::add_entry())
+  for(int i=0; i<t.get_subtl_size(); ++i){
+    const Sub_Timeline& subtl = t.get_subtl(i);
+    mix(uint64_t(subtl.get_a()) | uint64_t(subtl.task_num) << 16 | uint64_t(subtl.duration) << 32);
+  }
+  return h;
+}
+
+// Reads timelines of one timeline file line by line and adds their times to an Aggregate.
+// This is what main()'s while(getline(ifs, line)) loop used to do. I moved it here so that the same accounting can be
+// used for several input files.
+// Instead of keeping all Timelines in tl_vec, only the current and previous ones are kept, because the duration of a
+// timeline needs only the previous timeline's end time.
+// A timeline file may also have date lines in the middle, e.g. when the files of several days are concatenated into
+// one archive. A date line starts again from its date like a new file: the timeline after it is the starting point.
+struct Ingest {
+  Ingest(Aggregate& a, const vector<Entry_listener>& l = {}) : agg{a}, listeners{l}, c{1} {}
+
+  bool read_date(const string& line); // read the first line (mm/dd/yyyy) into the global date
+  bool feed(string& line);	      // read one timeline or a date line (line is normalized by normalize_utf8() in
+				      // place). Returns false if it cannot be read (the error is printed)
+  bool restart(const string& line);   // read a date line in the middle of a file
+  void add(Timeline&& tl);	      // add a timeline already read by operator>>()
+  void add_dated(Timeline&& tl);      // add a timeline whose end_t already has its date (--merge-devices)
+
+  Aggregate& agg;
+  vector<Entry_listener> listeners;
+  Timeline prev, cur;
+  int c;			// count the number of timelines (and date lines in the middle)
+  int first_c{1};		// c of the first timeline after the last date line (the starting point, not counted)
+  bool clip_subs{false};	// shorten sub-activities not fitting in the interval, instead of throwing an error
+  int n_clipped{0};		// the number of timelines whose sub-activities are shortened
+
+private:
+  void add_cur();		// add the times of cur to agg
+  void count(time_t b, time_t e); // add cur, whose interval is [b, e), to agg and the listeners
+};
+
+bool Ingest::read_date(const string& l){
+  string line{l};
+  normalize_utf8(line);		// e.g. full-width digits
+  istringstream iss{line};
+  //tm date;			// std::tm
+  // for operator>>(istream& is, Timeline& t) to access the date info, I made date global
+  date = tm{};
+  iss >> get_time(&date, "%m/%d/%Y");
+  // %m: 01-12. leading 0 is permitted but not required
+  if(iss.fail()){
+    cerr << "Error in reading the first line as a date\n";
+    cerr << "Required format: mm/dd/yyyy, e.g. 9/15/2025" << endl;
+    return false;
+  }
+  date.tm_hour = 0;
+  date.tm_min = 0;
+  date.tm_sec = 0;
+  // these pieces of info below date.tm_mday are not used, but to avoid any mistake when forwarding date by 1 day
+  // below (at if(e<b){...} in set_dates() function), I set them to 0.
+  return true;
+}
+
+// whether line is a date line (mm/dd/yyyy) rather than a timeline ("- ...")
+bool is_date_line(const string& line){
+  size_t i = line.find_first_not_of(" \t");
+  return i != string::npos && isdigit((unsigned char)line[i]);
+}
+
+bool Ingest::restart(const string& line){
+  if(!read_date(line))
+    return false;
+  ++c;
+  first_c = c;
+  return true;
+}
+
+bool Ingest::feed(string& line){
+  normalize_utf8(line);
+  if(is_date_line(line))
+    return restart(line);
+  istringstream iss{line};
+  // ref: https://stackoverflow.com/questions/2767298/c-repeatedly-using-istringstream
+
+  cur = Timeline();		// reset to an empty Timeline
+  if(!(iss >> cur)){ // check if iss is in good() condition. if(istream) checks if istream is in good()
+    cerr << "At " << c << "-th Timeline, an reading error happened\n";
+    return false;
+  }
+  add_cur();
+  return true;
+}
+
+void Ingest::add(Timeline&& tl){
+  cur = move(tl);
+  add_cur();
+}
+
+void Ingest::add_cur(){
+  if(c > first_c){		// calculate the number of minutes to pass from the last end time
+    time_t b, e;
+    tm *b_tm, *e_tm;		// used to create b and e of time_t
+    b_tm = &(prev.end_t);
+    // b_tm/e_tm point to end_t of the Timeline objects, so that set_dates() below updates the year/month/day of the
+    // Timeline objects themselves (it's desirable for the Timeline objects to have the correct date info, as well as
+    // hour and minute).
+      
+    e_tm = &(cur.end_t);
+    date = set_dates(date, b_tm, e_tm); // update date if necessary
+    // when e_tm goes to the next day, update the global variable "date".
+      
+    //b = mktime(b_tm);
+    //e = mktime(e_tm);
+    b = timegm(b_tm); // UTC version of mktime(), to avoid setting tm_isdst flag
+    e = timegm(e_tm);
+    if(!agg.dedup || agg.dedup->insert(timeline_hash(cur, e), e))
+      count(b, e);
+    else
+      ++agg.dedup->n_skipped;
+    // A skipped timeline still becomes prev below, so the next timeline's interval starts at it (the interval of
+    // the skipped one is counted in the file where it appeared first).
+  }
+  else{
+    // the first timeline is only the starting point of time count. Give its end_t the date of the file.
+    // (set_dates() does this for the following timelines)
+    tm dummy_tm{cur.end_t};
+    set_dates(date, &dummy_tm, &cur.end_t);
+    // (not added to dedup: it's not counted here, so its copy in another file must be counted)
+  }
+  agg.note_timeline(cur, timegm(&cur.end_t));
+  // for debug
+  //cout << "### " << c << "-th Timeline:" << endl;
+  //cur.print_tl();
+  //cout << endl;
+
+  swap(prev, cur);
+  ++c;
+}
+
+void Ingest::add_dated(Timeline&& tl){
+  cur = move(tl);
+  if(c > first_c)
+    count(timegm(&prev.end_t), timegm(&cur.end_t));
+  agg.note_timeline(cur, timegm(&cur.end_t));
+  swap(prev, cur);
+  ++c;
+}
+
+void Ingest::count(time_t b, time_t e){
+  double seconds = difftime(e, b);
+  //cout << "### Duration [min] = " << seconds/60 << endl;
+
+  if(clip_subs){
+    long long sub_min{0};
+    for(int i=0; i<cur.get_subtl_size(); ++i)
+      sub_min += cur.get_subtl(i).duration;
+    if(sub_min*60 > seconds){
+      cur.clip_subtl(seconds/60);
+      ++n_clipped;
+    }
+  }
+
+  // subtract sub-activities' durations from seconds (they are added to the aggregate in add_entry())
+  for(int i=0; i<cur.get_subtl_size(); ++i){
+    const Sub_Timeline& subtl = cur.get_subtl(i);
+    seconds -= subtl.duration*60; // Sub_Timeline::duration is in minutes, so convert it to seconds
+    if(seconds < 0){
+      cerr << "Error in subtracting sub-activity's duration from the main activity's duration." << endl;
+      cerr << c << "-th Timeline, ";
+      throw runtime_error("The main duration became negative");
+    }
+  }
+  if(e < agg.from || e >= agg.to)
+    return;			// (checked after the errors above, which stop the run on any day)
+  agg.add_entry(cur, seconds/60, e); // store in minutes
+
+  if(!listeners.empty()){
+    Resolved_entry re{&cur, b, e, (long long)(seconds/60), c, {}};
+    for(int i=0; i<cur.get_subtl_size(); ++i){
+      const Sub_Timeline& subtl = cur.get_subtl(i);
+      for(const Sub_Timeline::Span& s : subtl.spans){
+	pair<time_t, time_t> se = resolve_sub_span(s, b, e);
+	re.sub_intervals.push_back({subtl.get_a(), subtl.task_num, se.first, se.second});
+      }
+    }
+    for(const Entry_listener& l : listeners)
+      l(re);
+  }
+}
+
+// Read a timeline file (the date line and the timelines) from is and add its times to agg.
+// Returns false when the file cannot be read (the error is printed to cerr).
+// line0: the number of the first line of is in the whole file (0 for the date line at the top), when is is a part of
+// a file (see read_timeline_days()). The timelines are numbered (Resolved_entry::line_num, error messages) from it.
+bool read_timeline_file(istream& is, Aggregate& agg, const vector<Entry_listener>& listeners = {}, int line0 = 0){
+  string line;
+  Ingest ingest{agg, listeners};
+  ingest.c = ingest.first_c = line0 + 1;
+  
+  // get the first line and read the date mm/dd/yyy
+  getline(is, line);
+  if(!ingest.read_date(line))
+    return false;
+
+  while(getline(is, line))
+    if(!ingest.feed(line))
+      return false;
+  return true;
+}
+
+// print "Total <label> time: ..." for category i, followed by its child categories (indented with a tab per level)
+void print_category(ostream& os, int i, const vector<long long>& total_vec, int depth){
+  os << string(depth, '\t') << (depth ? "" : "Total ") << taxonomy.categories[i].label << " time: "
+     << total_vec[i] << " [mins]" << endl;
+  for(int k=i+1; k<taxonomy.size(); ++k)
+    if(taxonomy.categories[k].parent == i)
+      print_category(os, k, total_vec, depth+1);
+}
+
+void print_report(ostream& os, const Aggregate& agg){
+  // The report used to be a switch statement over the activity types. Now it goes through the taxonomy, so that
+  // categories added by a taxonomy file are also reported. A child category's time is added to its parent's total,
+  // and the child is listed below its parent.
+  vector<long long> total_vec{agg.act_min};
+  total_vec.resize(max<size_t>(total_vec.size(), taxonomy.size()), 0);
+  // Since a parent always appears before its child in taxonomy.categories (Taxonomy::load() requires the parent to be
+  // defined first), adding from the last category to the first accumulates grandchildren correctly.
+  for(int i=taxonomy.size()-1; i>0; --i)
+    if(taxonomy.categories[i].parent)
+      total_vec[taxonomy.categories[i].parent] += total_vec[i];
+
+  for(int i=1; i<taxonomy.size(); ++i){ // activity_type::not_set=1, so start with i=1
+    if(i == int(activity_type::error) || taxonomy.categories[i].parent)
+      continue;
+    print_category(os, i, total_vec, 0);
+    if(i == int(activity_type::task)){
+      os << "\tUnclassified task time: " << agg.task_min[0] << " [mins]" << endl;
+      for(int i=1; i<int(agg.task_min.size()); ++i){
+	os << "\tTask " << i << " time: " << agg.task_min[i] << " [mins]" << endl;
+      }
+    }
+  }
+}
+
+string format_time(time_t t);	// defined in the interval index section
+
+// print the session-length percentiles per activity type, the longest blocks and the most time-consuming phrases
+void print_distribution(ostream& os, const Aggregate& agg, size_t top_n){
+  const Sketches& sk = agg.sketches;
+  os << "Session lengths [mins] (approximate percentiles):" << endl;
+  for(size_t i=0; i<sk.session_min.size(); ++i){
+    const Kll_sketch& q = sk.session_min[i];
+    if(q.count() == 0)
+      continue;
+    os << "\t" << convert_a2s(activity_type(i)) << ": " << q.count() << " sessions, p50 " << q.quantile(0.5)
+       << ", p90 " << q.quantile(0.9) << ", p99 " << q.quantile(0.99) << ", max " << q.quantile(1.0) << endl;
+  }
+
+  vector<Long_block> longest{sk.longest};
+  sort(longest.begin(), longest.end(), longer_block);
+  if(longest.size() > top_n)
+    longest.resize(top_n);
+  os << "Longest blocks:" << endl;
+  for(const Long_block& b : longest){
+    os << "\t" << b.min << " [mins] " << convert_a2s(b.a);
+    if(b.a == activity_type::task && b.task_num)
+      os << " " << b.task_num;
+    os << ", ended at " << format_time(b.end);
+    if(!b.phrase.empty())
+      os << ": " << b.phrase;
+    os << endl;
+  }
+
+  os << "Most time-consuming phrases:" << endl;
+  for(const Space_saving::Counter& c : sk.phrases.top(top_n)){
+    os << "\t" << c.item << ": " << c.count << " [mins]";
+    if(c.error)
+      os << " (at most " << c.error << " mins overcounted)";
+    os << endl;
+  }
+}
+
+// ############################################################
+// Partial aggregate files (--emit-partial, count_times merge)
+// ############################################################
+
+// Binary format (all integers are LEB128 varints; signed ones are zigzag-encoded):
+//   "CTPA" (magic), version
+//   number of categories, then for each category: id, label, parent id (strings: length + bytes)
+//   per-category minutes
+//   number of tasks, per-task minutes
+//   number of days, then for each day: day (delta from the previous day), number of nonzero categories,
+//     (category index, minutes) pairs
+//   has_entries, first_t, last_t, first_a, first_task, (version 3) first_counted,
+//     number of first_subs, (a, task_num, min, (version 3) counted) per sub-activity
+//   (version 2) with_sketches, and if it's 1:
+//     number of session-length sketches, then for each: count, number of levels, (level size, values) per level
+//     number of longest blocks, (min, end, a, task_num, phrase) per block
+//     number of phrase counters, (phrase, count, error) per counter
+// Categories are stored with their ids, so that partials made with different taxonomy files can be merged.
+const char partial_magic[4] = {'C', 'T', 'P', 'A'};
+const unsigned partial_version = 3; // versions 1 (without the sketches) and 2 (without the counted flags) can still be read
+
+void put_varint(ostream& os, uint64_t v){
+  while(v >= 0x80){
+    os.put(char(v | 0x80));
+    v >>= 7;
+  }
+  os.put(char(v));
+}
+
+void put_svarint(ostream& os, long long v){
+  put_varint(os, (uint64_t(v) << 1) ^ uint64_t(v >> 63)); // zigzag: small negative numbers become small, too
+}
+
+void put_string(ostream& os, const string& s){
+  put_varint(os, s.size());
+  os.write(s.data(), s.size());
+}
+
+uint64_t get_varint(istream& is){
+  uint64_t v{0};
+  for(int shift=0; shift<64; shift+=7){
+    int ch = is.get();
+    if(ch == EOF)
+      throw runtime_error("Error in reading a binary file: unexpected end of file");
+    v |= uint64_t(ch & 0x7f) << shift;
+    if(!(ch & 0x80))
+      return v;
+  }
+  throw runtime_error("Error in reading a binary file: broken number");
+}
+
+long long get_svarint(istream& is){
+  uint64_t v = get_varint(is);
+  return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+string get_string(istream& is){
+  uint64_t n = get_varint(is);
+  if(n > (1<<20))
+    throw runtime_error("Error in reading a binary file: broken string");
+  string s(n, '\0');
+  if(!is.read(&s[0], n))
+    throw runtime_error("Error in reading a binary file: unexpected end of file");
+  return s;
+}
+
+// the category table of the current taxonomy (also used by the content index)
+void put_categories(ostream& os){
+  put_varint(os, taxonomy.size());
+  for(int i=1; i<taxonomy.size(); ++i){
+    const Activity_category& cat = taxonomy.categories[i];
+    put_string(os, cat.id);
+    put_string(os, cat.label);
+    put_string(os, cat.parent ? taxonomy.categories[cat.parent].id : "");
+  }
+}
+
+// Read a category table written by put_categories() and return the map from the category indexes in the file to the
+// ones in the current taxonomy. Categories unknown to the current taxonomy are added to it.
+vector<int> read_categories(istream& is){
+  uint64_t n_cat = get_varint(is);
+  if(n_cat > (1<<16))
+    throw runtime_error("Error in reading a binary file: broken category table");
+  vector<int> cat_map(n_cat, 0);
+  for(uint64_t i=1; i<n_cat; ++i){
+    string id = get_string(is), label = get_string(is), parent = get_string(is);
+    int k = taxonomy.find_id(id);
+    if(k == 0){
+      Activity_category cat;
+      cat.id = id; cat.label = label; cat.name = label;
+      cat.parent = taxonomy.find_id(parent); // the parent comes before its child in the file, too
+      taxonomy.categories.push_back(cat);
+      k = taxonomy.size()-1;
+    }
+    cat_map[i] = k;
+  }
+  return cat_map;
+}
+
+void write_partial(ostream& os, const Aggregate& agg){
+  os.write(partial_magic, 4);
+  put_varint(os, partial_version);
+
+  put_categories(os);
+  for(int i=1; i<taxonomy.size(); ++i)
+    put_svarint(os, i < int(agg.act_min.size()) ? agg.act_min[i] : 0);
+
+  put_varint(os, agg.task_min.size());
+  for(long long m : agg.task_min)
+    put_svarint(os, m);
+
+  put_varint(os, agg.day_min.size());
+  long long prev_day{0};
+  for(const auto& d : agg.day_min){
+    put_svarint(os, d.first - prev_day);
+    prev_day = d.first;
+    int n{0};
+    for(long long m : d.second)
+      n += m != 0;
+    put_varint(os, n);
+    for(size_t i=0; i<d.second.size(); ++i)
+      if(d.second[i]){
+	put_varint(os, i);
+	put_svarint(os, d.second[i]);
+      }
+  }
+
+  put_varint(os, agg.has_entries);
+  put_svarint(os, agg.first_t);
+  put_svarint(os, agg.last_t);
+  put_varint(os, int(agg.first_a));
+  put_varint(os, agg.first_task);
+  put_varint(os, agg.first_counted);
+  put_varint(os, agg.first_subs.size());
+  for(const Aggregate::Sub_minutes& s : agg.first_subs){
+    put_varint(os, int(s.a));
+    put_varint(os, s.task_num);
+    put_svarint(os, s.min);
+    put_varint(os, s.counted);
+  }
+
+  put_varint(os, agg.with_sketches);
+  if(agg.with_sketches){
+    const Sketches& sk = agg.sketches;
+    put_varint(os, sk.session_min.size());
+    for(const Kll_sketch& q : sk.session_min)
+      q.write(os);
+    put_varint(os, sk.longest.size());
+    for(const Long_block& b : sk.longest){
+      put_svarint(os, b.min);
+      put_svarint(os, b.end);
+      put_varint(os, int(b.a));
+      put_varint(os, b.task_num);
+      put_string(os, b.phrase);
+    }
+    sk.phrases.write(os);
+  }
+  if(!os)
+    throw runtime_error("Error in writing a partial aggregate");
+}
+
+void Kll_sketch::write(ostream& os) const {
+  put_varint(os, n);
+  put_varint(os, levels.size());
+  for(const vector<int>& l : levels){
+    put_varint(os, l.size());
+    for(int v : l)
+      put_svarint(os, v);
+  }
+}
+
+void Kll_sketch::read(istream& is){
+  n = get_varint(is);
+  uint64_t n_level = get_varint(is);
+  if(n_level == 0 || n_level > 64)
+    throw runtime_error("Error in reading a partial aggregate: broken sketch");
+  levels.assign(n_level, {});
+  for(vector<int>& l : levels){
+    uint64_t size = get_varint(is);
+    if(size > 4*k)
+      throw runtime_error("Error in reading a partial aggregate: broken sketch");
+    for(uint64_t i=0; i<size; ++i)
+      l.push_back(get_svarint(is));
+  }
+}
+
+void Space_saving::write(ostream& os) const {
+  put_varint(os, counters.size());
+  for(const Counter& c : counters){
+    put_string(os, c.item);
+    put_svarint(os, c.count);
+    put_svarint(os, c.error);
+  }
+}
+
+void Space_saving::read(istream& is){
+  uint64_t size = get_varint(is);
+  if(size > capacity)
+    throw runtime_error("Error in reading a partial aggregate: broken phrase counters");
+  counters.clear();
+  pos.clear();
+  for(uint64_t i=0; i<size; ++i){
+    Counter c;
+    c.item = get_string(is);
+    c.count = get_svarint(is);
+    c.error = get_svarint(is);
+    pos[c.item] = counters.size();
+    counters.push_back(c);
+  }
+}
+
+// read a partial aggregate written by write_partial(). Categories unknown to the current taxonomy are added to it.
+Aggregate read_partial(istream& is){
+  char magic[4];
+  if(!is.read(magic, 4) || !equal(magic, magic+4, partial_magic))
+    throw runtime_error("Error in reading a partial aggregate: not a partial aggregate file");
+  uint64_t version = get_varint(is);
+  if(version < 1 || version > partial_version)
+    throw runtime_error("Error in reading a partial aggregate: unsupported version " + to_string(version));
+
+  // map the category indexes in the file to the ones in the current taxonomy
+  vector<int> cat_map = read_categories(is);
+  uint64_t n_cat = cat_map.size();
+  auto map_cat = [&](uint64_t i){
+    if(i == 0 || i >= n_cat)
+      throw runtime_error("Error in reading a partial aggregate: broken category index");
+    return cat_map[i];
+  };
+
+  Aggregate agg;
+  agg.act_min.resize(taxonomy.size(), 0);
+  for(uint64_t i=1; i<n_cat; ++i)
+    agg.act_min[cat_map[i]] += get_svarint(is);
+
+  uint64_t n_task = get_varint(is);
+  if(n_task == 0 || n_task > (1<<16))
+    throw runtime_error("Error in reading a partial aggregate: broken task table");
+  agg.task_min.assign(n_task, 0);
+  for(long long& m : agg.task_min)
+    m = get_svarint(is);
+
+  uint64_t n_day = get_varint(is);
+  long long day{0};
+  for(uint64_t d=0; d<n_day; ++d){
+    day += get_svarint(is);
+    vector<long long>& v = agg.day_min[day];
+    v.resize(taxonomy.size(), 0);
+    uint64_t n = get_varint(is);
+    for(uint64_t k=0; k<n; ++k){
+      int i = map_cat(get_varint(is));
+      v[i] += get_svarint(is);
+    }
+  }
+
+  agg.has_entries = get_varint(is);
+  agg.first_t = get_svarint(is);
+  agg.last_t = get_svarint(is);
+  agg.first_a = activity_type(map_cat(get_varint(is)));
+  agg.first_task = get_varint(is);
+  if(version >= 3)
+    agg.first_counted = get_varint(is);
+  uint64_t n_sub = get_varint(is);
+  for(uint64_t k=0; k<n_sub; ++k){
+    Aggregate::Sub_minutes s;
+    s.a = activity_type(map_cat(get_varint(is)));
+    s.task_num = get_varint(is);
+    s.min = get_svarint(is);
+    if(version >= 3)
+      s.counted = get_varint(is);
+    agg.first_subs.push_back(s);
+  }
+
+  if(version >= 2 && get_varint(is)){
+    agg.with_sketches = true;
+    Sketches& sk = agg.sketches;
+    uint64_t n_sketch = get_varint(is);
+    if(n_sketch > n_cat)
+      throw runtime_error("Error in reading a partial aggregate: broken sketch table");
+    for(uint64_t i=0; i<n_sketch; ++i){
+      Kll_sketch q;
+      q.read(is);
+      if(q.count() == 0)
+	continue;
+      int k = map_cat(i);
+      if(int(sk.session_min.size()) <= k)
+	sk.session_min.resize(k+1);
+      sk.session_min[k].merge(q);
+    }
+    uint64_t n_block = get_varint(is);
+    if(n_block > Sketches::n_longest)
+      throw runtime_error("Error in reading a partial aggregate: broken block table");
+    for(uint64_t i=0; i<n_block; ++i){
+      Long_block b;
+      b.min = get_svarint(is);
+      b.end = get_svarint(is);
+      b.a = activity_type(map_cat(get_varint(is)));
+      b.task_num = get_varint(is);
+      b.phrase = get_string(is);
+      sk.add_block(b);
+    }
+    sk.phrases.read(is);
+  }
+  return agg;
+}
+
+// ############################################################
+// Resumable batch runs (--journal)
+// ############################################################
+
+// The identity of an input file: when one of these changes, the file is read again
+struct File_stamp {
+  long long size, mtime_ns;
+  bool operator==(const File_stamp& o) const {return size == o.size && mtime_ns == o.mtime_ns;}
+};
+
+File_stamp file_stamp(const string& fname){
+  struct stat st;
+  if(stat(fname.c_str(), &st) != 0)
+    throw invalid_argument("Error: cannot open file " + fname);
+  return {(long long)st.st_size, (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec};
+}
+
+// An append-only journal of the input files already counted and their partial aggregates, so that a long run over
+// many files (killed, or stopped by a bad line) can be started again without reading the finished files again.
+// Format:
+//   "CTJN" (magic), version, the options fingerprint (string. See journal_fingerprint())
+//   records: file name (string), size (svarint), mtime in ns (svarint), the partial aggregate (string. See
+//	      write_partial()), then the FNV-1a hash of the bytes of this record before it (8 bytes, little endian)
+// A record is written with one write() and fsync()ed every "checkpoint" records (and at the end). A record torn by a
+// crash fails its hash, and the journal is cut before it when it's opened again.
+// Errors are thrown as runtime_error.
+class Journal {
+public:
+  Journal(const string& fname, const string& fingerprint, int checkpoint);
+  ~Journal();
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  // the aggregate of fname recorded in the journal, or nullptr if fname is not recorded or has been modified
+  const Aggregate* find(const string& fname, const File_stamp& stamp) const;
+  void append(const string& fname, const File_stamp& stamp, const Aggregate& agg);
+  void sync();
+  size_t size() const {return done.size();}
+
+private:
+  static const char magic[4];
+  static const uint64_t version = 1;
+  string fname;
+  int fd{-1};
+  int checkpoint;
+  int n_unsynced{0};
+  map<string, pair<File_stamp, Aggregate>> done;
+
+  static uint64_t fnv1a(const char* p, size_t n){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i=0; i<n; ++i){
+      h ^= (unsigned char)p[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+  void write_all(const string& bytes);
+};
+
+const char Journal::magic[4] = {'C', 'T', 'J', 'N'};
+
+Journal::Journal(const string& f, const string& fingerprint, int cp)
+  : fname{f}, checkpoint{cp}
+{
+  string data;
+  {
+    ifstream ifs{fname, ios_base::binary};
+    if(ifs)
+      data.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+  }
+  size_t good{0};		// the end of the last complete record
+  if(!data.empty()){
+    istringstream iss{data};
+    char m[4];
+    if(!iss.read(m, 4) || !equal(m, m+4, magic) || get_varint(iss) != version)
+      throw runtime_error("Error: " + fname + " is not a journal of count_times");
+    if(get_string(iss) != fingerprint)
+      throw runtime_error("Error: the journal " + fname + " was made with other options (--where, --main-only, "
+			  "--taxonomy). Use the same options, or remove the journal to start over");
+    good = iss.tellg();
+    while(good < data.size()){
+      try{
+	string name = get_string(iss);
+	File_stamp stamp;
+	stamp.size = get_svarint(iss);
+	stamp.mtime_ns = get_svarint(iss);
+	istringstream pss{get_string(iss)};
+	size_t end = iss.tellg();
+	char h[8];
+	if(!iss.read(h, 8))
+	  break;
+	uint64_t hash{0};
+	for(int i=7; i>=0; --i)
+	  hash = hash << 8 | (unsigned char)h[i];
+	if(hash != fnv1a(data.data() + good, end - good))
+	  break;
+	done[name] = {stamp, read_partial(pss)};
+	good = end + 8;
+      }
+      catch(runtime_error&){
+	break;			// a torn record at the end
+      }
+    }
+  }
+
+  fd = open(fname.c_str(), O_WRONLY | O_CREAT, 0644);
+  if(fd < 0)
+    throw runtime_error("Error: cannot open file " + fname);
+  if(data.empty()){
+    ostringstream oss;
+    oss.write(magic, 4);
+    put_varint(oss, version);
+    put_string(oss, fingerprint);
+    write_all(oss.str());
+    sync();
+  }
+  else{
+    if(good < data.size())
+      cerr << "The last record of the journal " << fname << " is incomplete. It's dropped" << endl;
+    if(ftruncate(fd, good) != 0 || lseek(fd, good, SEEK_SET) < 0)
+      throw runtime_error("Error in writing " + fname + ": " + strerror(errno));
+  }
+}
+
+Journal::~Journal(){
+  if(fd >= 0){
+    if(n_unsynced)
+      fsync(fd);
+    close(fd);
+  }
+}
+
+const Aggregate* Journal::find(const string& name, const File_stamp& stamp) const {
+  auto it = done.find(name);
+  return it != done.end() && it->second.first == stamp ? &it->second.second : nullptr;
+}
+
+void Journal::append(const string& name, const File_stamp& stamp, const Aggregate& agg){
+  ostringstream oss, pss;
+  put_string(oss, name);
+  put_svarint(oss, stamp.size);
+  put_svarint(oss, stamp.mtime_ns);
+  write_partial(pss, agg);
+  put_string(oss, pss.str());
+  string rec = oss.str();
+  uint64_t hash = fnv1a(rec.data(), rec.size());
+  for(int i=0; i<8; ++i, hash >>= 8)
+    rec.push_back(char(hash & 0xff));
+  write_all(rec);
+  done[name] = {stamp, agg};
+  if(++n_unsynced >= checkpoint)
+    sync();
+}
+
+void Journal::sync(){
+  if(fsync(fd) != 0)
+    throw runtime_error("Error in writing " + fname + ": " + strerror(errno));
+  n_unsynced = 0;
+}
+
+void Journal::write_all(const string& bytes){
+  size_t done_bytes{0};
+  while(done_bytes < bytes.size()){
+    ssize_t k = write(fd, bytes.data() + done_bytes, bytes.size() - done_bytes);
+    if(k < 0 && errno == EINTR)
+      continue;
+    if(k <= 0)
+      throw runtime_error("Error in writing " + fname + ": " + strerror(errno));
+    done_bytes += k;
+  }
+}
+
+// The options that change the aggregate of a file. A journal made with other options cannot be reused.
+string journal_fingerprint(const string& where, bool main_only){
+  ostringstream oss;
+  oss << "where=" << where << ";main-only=" << main_only << ";taxonomy=";
+  for(int i=1; i<taxonomy.size(); ++i){
+    oss << taxonomy.categories[i].id << ':' << taxonomy.categories[i].parent;
+    for(const string& c : taxonomy.categories[i].codes)
+      oss << ',' << c;
+    oss << ';';
+  }
+  return oss.str();
+}
+
+// The timeline files given on the command line, with each directory replaced by the files in it (recursively, in
+// the order of their names, except hidden files)
+vector<string> expand_directories(const vector<string>& inputs){
+  vector<string> files;
+  for(const string& in : inputs){
+    struct stat st;
+    if(stat(in.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)){
+      files.push_back(in);	// (an error for a missing file is reported when it's opened)
+      continue;
+    }
+    DIR* dir = opendir(in.c_str());
+    if(!dir)
+      throw invalid_argument("Error: cannot open directory " + in);
+    vector<string> names;
+    while(dirent* e = readdir(dir))
+      if(e->d_name[0] != '.')
+	names.push_back(in + (in.back() == '/' ? "" : "/") + e->d_name);
+    closedir(dir);
+    sort(names.begin(), names.end());
+    for(const string& f : expand_directories(names))
+      files.push_back(f);
+  }
+  return files;
+}
+
+// ############################################################
+// Date index of a timeline file (--build-date-index, --from/--to)
+// ############################################################
+
+// A small sidecar file (<timeline file>.ctdx) telling where each day starts in a (long, concatenated) plain timeline
+// file, so that counting a few days with --from/--to reads only their bytes (pread()) instead of the whole file.
+// The day of a timeline is known only by following the date rollovers from the date line, so each entry keeps where
+// to start reading for a day: the date line of the day, or the last timeline of the previous day (its own time is not
+// counted, it's the starting point) with that timeline's date.
+// Format: "CTDX" (magic), version, size and mtime in ns of the timeline file (svarint), the number of entries, and for
+// each entry: day (days since 1970-01-01, svarint delta), offset (varint delta), next - offset (varint), the day of
+// the starting line (svarint), whether it's a date line (varint), the line number of the starting line (varint
+// delta), then the FNV-1a hash of all the bytes before it (8 bytes, little endian).
+// (Version 2 added the line numbers, so that --at and --overlaps show the same "N-th Timeline" as without the index.
+// A version 1 index is out of date.)
+struct Date_index {
+  struct Entry {
+    long long day;		// the first day counted when reading from offset
+    long long offset, next;	// the starting line is [offset, next) in the file
+    long long start_day;	// the date of the starting line (a timeline)
+    bool date_line;		// the starting line is a date line
+    long long line;		// the number of the starting line in the file (0 for the first line)
+  };
+  File_stamp stamp;
+  vector<Entry> entries;	// in the order of day (and offset)
+
+  void write(ostream& os) const;
+  bool read(istream& is);	// false if is is not a valid date index
+
+  // the bytes [begin, end) to read for the days [from, to), and the date line to put before them (empty if the
+  // bytes start with a date line). line is the number of the first line of the bytes in the file.
+  void span(long long from, long long to, long long& begin, long long& end, string& header, long long& line) const;
+};
+
+string date_index_name(const string& fname){return fname + ".ctdx";}
+
+namespace {
+const char date_index_magic[4] = {'C', 'T', 'D', 'X'};
+
+uint64_t fnv1a_64(const string& s){
+  uint64_t h = 14695981039346656037ULL;
+  for(unsigned char ch : s){
+    h ^= ch;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+}
+
+void Date_index::write(ostream& os) const {
+  ostringstream oss;
+  oss.write(date_index_magic, 4);
+  put_varint(oss, 2);
+  put_svarint(oss, stamp.size);
+  put_svarint(oss, stamp.mtime_ns);
+  put_varint(oss, entries.size());
+  long long day{0}, offset{0}, line{0};
+  for(const Entry& e : entries){
+    put_svarint(oss, e.day - day);
+    put_varint(oss, e.offset - offset);
+    put_varint(oss, e.next - e.offset);
+    put_svarint(oss, e.start_day);
+    put_varint(oss, e.date_line);
+    put_varint(oss, e.line - line);
+    day = e.day;
+    offset = e.offset;
+    line = e.line;
+  }
+  string s = oss.str();
+  uint64_t h = fnv1a_64(s);
+  for(int i=0; i<8; ++i, h >>= 8)
+    s.push_back(char(h & 0xff));
+  os.write(s.data(), s.size());
+}
+
+bool Date_index::read(istream& is){
+  string s{istreambuf_iterator<char>(is), istreambuf_iterator<char>()};
+  if(s.size() < 12)
+    return false;
+  uint64_t h{0};
+  for(int i=7; i>=0; --i)
+    h = h << 8 | (unsigned char)s[s.size()-8+i];
+  s.resize(s.size()-8);
+  if(h != fnv1a_64(s) || !equal(s.begin(), s.begin()+4, date_index_magic))
+    return false;
+  try{
+    istringstream iss{s.substr(4)};
+    if(get_varint(iss) != 2)
+      return false;
+    stamp.size = get_svarint(iss);
+    stamp.mtime_ns = get_svarint(iss);
+    uint64_t n = get_varint(iss);
+    entries.clear();
+    long long day{0}, offset{0}, line{0};
+    for(uint64_t i=0; i<n; ++i){
+      Entry e;
+      e.day = day += get_svarint(iss);
+      e.offset = offset += get_varint(iss);
+      e.next = e.offset + get_varint(iss);
+      e.start_day = get_svarint(iss);
+      e.date_line = get_varint(iss);
+      e.line = line += get_varint(iss);
+      entries.push_back(e);
+    }
+  }
+  catch(runtime_error&){
+    return false;
+  }
+  return true;
+}
+
+void Date_index::span(long long from, long long to, long long& begin, long long& end, string& header,
+		      long long& line) const {
+  auto first_at = [this](long long day){
+    return lower_bound(entries.begin(), entries.end(), day, [](const Entry& e, long long d){return e.day < d;});
+  };
+  auto b = first_at(from);
+  if(b != entries.begin() && (b == entries.end() || b->day > from))
+    --b;			// from is in the middle of the day of b[-1] (no entry for the day itself)
+  if(b == entries.end()){	// (an empty index)
+    begin = end = line = 0;
+    return;
+  }
+  begin = b->offset;
+  line = b->line;
+  header.clear();
+  if(!b->date_line){
+    time_t t = b->start_day * 86400;
+    char buff[16];
+    strftime(buff, sizeof(buff), "%m/%d/%Y", gmtime(&t));
+    header = buff;
+  }
+  auto e = first_at(to);
+  end = e == entries.end() ? stamp.size : e->next; // (the starting line of the day "to" still belongs to to-1)
+}
+
+// Read a plain timeline file once and make its date index. Only the time stamps are read (see Parse_fields).
+// Errors are thrown as runtime_error.
+Date_index build_date_index(const string& fname){
+  Date_index dix;
+  dix.stamp = file_stamp(fname);
+  ifstream ifs{fname, ios_base::binary};
+  if(!ifs)
+    throw runtime_error("Error: cannot open file " + fname);
+  Parse_fields saved = parse_fields;
+  parse_fields = {false, false};
+  Aggregate agg;
+  Ingest ingest{agg};
+  string line;
+  long long offset{0}, prev_offset{0}, prev_next{0};
+  long long line_num{0}, prev_line{0};
+  long long last_day{0};
+  bool has_day{false};
+  auto add = [&](const Date_index::Entry& e){
+    if(!dix.entries.empty() && e.day < dix.entries.back().day){
+      parse_fields = saved;
+      throw runtime_error("Error: the dates in " + fname + " are not in order, so it cannot have a date index");
+    }
+    if(dix.entries.empty() || e.day > dix.entries.back().day) // (a date line of the current day adds nothing)
+      dix.entries.push_back(e);
+  };
+  for(bool first{true}; getline(ifs, line); first = false, ++line_num){
+    long long next = offset + line.size() + (ifs.eof() ? 0 : 1);
+    bool header = first || is_date_line(line);
+    if(header ? !ingest.restart(line) : !ingest.feed(line)){
+      parse_fields = saved;
+      throw runtime_error("Error in reading " + fname);
+    }
+    if(header){
+      last_day = timegm(&date) / 86400;
+      add({last_day, offset, next, last_day, true, line_num});
+      has_day = true;
+    }
+    else{
+      long long day = timegm(&ingest.prev.end_t) / 86400; // (Ingest swaps the new timeline into prev)
+      if(has_day && day != last_day)
+	add({day, prev_offset, prev_next, last_day, false, prev_line});
+      last_day = day;
+      prev_offset = offset;
+      prev_next = next;
+      prev_line = line_num;
+    }
+    offset = next;
+  }
+  parse_fields = saved;
+  return dix;
+}
+
+// The date index of fname if it exists and matches the file, or nullptr
+unique_ptr<Date_index> load_date_index(const string& fname){
+  ifstream ifs{date_index_name(fname), ios_base::binary};
+  if(!ifs)
+    return nullptr;
+  unique_ptr<Date_index> dix{new Date_index};
+  struct stat st;
+  if(!dix->read(ifs) || stat(fname.c_str(), &st) != 0 || !(dix->stamp == file_stamp(fname))){
+    cerr << "The date index " << date_index_name(fname) << " is out of date. " << fname << " is read from the beginning"
+	 << endl;
+    return nullptr;
+  }
+  return dix;
+}
+
+// Read the days [from, to) of a timeline file with its date index. Only the bytes of those days are read.
+// Returns false when the timelines cannot be read, like read_timeline_file().
+bool read_timeline_days(const string& fname, const Date_index& dix, long long from, long long to, Aggregate& agg,
+			const vector<Entry_listener>& listeners = {}){
+  long long begin, end, line;
+  string header;
+  dix.span(from, to, begin, end, header, line);
+  string data{header.empty() ? "" : header + "\n"};
+  size_t n0 = data.size();
+  data.resize(n0 + (end - begin));
+  int fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw runtime_error("Error: cannot open file " + fname);
+  for(long long done{0}; done < end - begin; ){
+    ssize_t k = pread(fd, &data[n0 + done], end - begin - done, begin + done);
+    if(k < 0 && errno == EINTR)
+      continue;
+    if(k <= 0){
+      close(fd);
+      throw runtime_error("Error in reading " + fname + ": " + strerror(k < 0 ? errno : EIO));
+    }
+    done += k;
+  }
+  close(fd);
+  istringstream iss{data};
+  return read_timeline_file(iss, agg, listeners, header.empty() ? line : line-1); // (header is not in the file)
+}
+
+// ############################################################
+// Input files (plain or compressed)
+// ############################################################
+
+// A queue with a fixed capacity shared by two threads. push() waits while the queue is full, and pop() waits while it's
+// empty. After close(), push() fails and pop() returns the remaining elements, then fails.
+template<class T>
+class Bounded_queue {
+public:
+  Bounded_queue(size_t cap) : capacity{cap}, closed{false} {}
+
+  bool push(T v){
+    unique_lock<mutex> lock{m};
+    not_full.wait(lock, [&]{return closed || q.size() < capacity;});
+    if(closed)
+      return false;
+    q.push_back(move(v));
+    not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(T& v){
+    unique_lock<mutex> lock{m};
+    not_empty.wait(lock, [&]{return closed || !q.empty();});
+    if(q.empty())
+      return false;		// closed and nothing left
+    v = move(q.front());
+    q.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close(){
+    lock_guard<mutex> lock{m};
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+private:
+  mutex m;
+  condition_variable not_full, not_empty;
+  deque<T> q;
+  size_t capacity;
+  bool closed;
+};
+
+// A streambuf that reads decompressed data produced by another thread.
+// The producer (decompression thread) takes an empty buffer from free_bufs, fills it and puts it into filled_bufs.
+// underflow() (called by getline() etc. when the current buffer is used up) gives the used buffer back to free_bufs and
+// takes the next filled one. Since only n_bufs buffers of buf_size bytes exist, the memory used for decompressed data
+// stays fixed, no matter how large the file is. The whole inflated file or a temporary file is never made.
+class Queue_streambuf : public streambuf {
+public:
+  static const size_t buf_size = 1<<16;
+  static const size_t n_bufs = 4;
+
+  Queue_streambuf() : free_bufs{n_bufs}, filled_bufs{n_bufs} {
+    for(size_t i=0; i<n_bufs; ++i)
+      free_bufs.push(vector<char>(buf_size));
+  }
+
+  // producer side
+  Bounded_queue<vector<char>> free_bufs;
+  Bounded_queue<vector<char>> filled_bufs; // each vector's size() is the number of valid bytes
+  exception_ptr error;			   // set by the producer when decompression failed (before closing filled_bufs)
+
+protected:
+  int_type underflow() override {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    if(!cur.empty()){
+      cur.resize(buf_size);
+      free_bufs.push(move(cur));
+      cur = vector<char>();
+    }
+    if(!filled_bufs.pop(cur)){
+      if(error)
+	rethrow_exception(error); // istream sets badbit and rethrows it, as exceptions(badbit) is set
+      return traits_type::eof();
+    }
+    setg(cur.data(), cur.data(), cur.data()+cur.size());
+    return cur.empty() ? underflow() : traits_type::to_int_type(*gptr());
+  }
+
+private:
+  vector<char> cur;
+};
+
+// An istream reading a compressed file (gzip or zstd). A decompression thread fills buffers while the parse thread
+// (the thread using this istream) reads lines from them, so decompression and parsing overlap.
+// When the program is compiled with -DUSE_ZLIB (and -lz) or -DUSE_ZSTD (and -lzstd), the libraries are used.
+// Otherwise, the external command (gzip -dc or zstd -dc) is run and its output is read through a pipe.
+class Decompressing_istream : public istream {
+public:
+  enum class Format {gzip, zstd};
+
+  Decompressing_istream(const string& fname, Format f) : istream{nullptr}, child{-1} {
+    rdbuf(&sb);
+    exceptions(ios_base::badbit);
+    worker = thread{[this, fname, f]{
+      try{
+	run(fname, f);
+      }
+      catch(...){
+	sb.error = current_exception();
+      }
+      sb.filled_bufs.close();
+    }};
+  }
+
+  ~Decompressing_istream(){
+    // when the reader stops early (e.g. a reading error), wake up the producer so that it can finish
+    sb.free_bufs.close();
+    sb.filled_bufs.close();
+    {
+      lock_guard<mutex> lock{child_m};
+      if(child > 0)
+	kill(child, SIGTERM);
+    }
+    worker.join();
+  }
+
+private:
+  Queue_streambuf sb;
+  thread worker;
+  // the process of run_command(), while it's not reaped yet. The worker thread sets and clears it and the destructor
+  // kills it, so it's guarded by child_m. The worker clears it before waitpid(), so the destructor never sends a
+  // signal to a pid that may have been reused by another process.
+  mutex child_m;
+  pid_t child;
+
+  void run(const string& fname, Format f);
+  void run_command(const char* cmd, const string& fname);
+};
+
+void Decompressing_istream::run(const string& fname, Format f){
+#ifdef USE_ZLIB
+  if(f == Format::gzip){
+    gzFile gz = gzopen(fname.c_str(), "rb");
+    if(!gz)
+      throw runtime_error("Error: cannot open file " + fname);
+    gzbuffer(gz, 1<<17);
+    vector<char> buf;
+    while(sb.free_bufs.pop(buf)){
+      buf.resize(Queue_streambuf::buf_size);
+      int n = gzread(gz, buf.data(), buf.size());
+      int errnum;
+      string msg{gzerror(gz, &errnum)};
+      if(n < 0 || (n == 0 && errnum != Z_OK)){ // a truncated file is reported at the end as Z_BUF_ERROR
+	gzclose(gz);
+	throw runtime_error("Error in decompressing " + fname + ": " + msg);
+      }
+      if(n == 0)
+	break;
+      buf.resize(n);
+      if(!sb.filled_bufs.push(std::move(buf)))
+	break;
+    }
+    gzclose(gz);
+    return;
+  }
+#endif
+#ifdef USE_ZSTD
+  if(f == Format::zstd){
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if(!fp)
+      throw runtime_error("Error: cannot open file " + fname);
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    vector<char> in(ZSTD_DStreamInSize());
+    ZSTD_inBuffer input{in.data(), 0, 0};
+    vector<char> buf;
+    bool eof{false}, done{false};
+    size_t ret{0};		// 0 when a frame has been decoded completely
+    while(!done && sb.free_bufs.pop(buf)){
+      buf.resize(Queue_streambuf::buf_size);
+      ZSTD_outBuffer output{buf.data(), buf.size(), 0};
+      while(output.pos < output.size){
+	if(input.pos == input.size && !eof){
+	  input.size = fread(in.data(), 1, in.size(), fp);
+	  input.pos = 0;
+	  eof = input.size == 0;
+	}
+	size_t before = output.pos;
+	size_t r = ZSTD_decompressStream(dctx, &output, &input);
+	// (after the end of the file, this is called with an empty input to flush the data kept in dctx)
+	bool flushed = eof && output.pos == before; // nothing more to come
+	if(ZSTD_isError(r) || (flushed && ret != 0)){
+	  string msg{ZSTD_isError(r) ? ZSTD_getErrorName(r) : "unexpected end of file"};
+	  ZSTD_freeDCtx(dctx);
+	  fclose(fp);
+	  throw runtime_error("Error in decompressing " + fname + ": " + msg);
+	}
+	if(flushed){
+	  done = true;
+	  break;
+	}
+	ret = r;
+      }
+      buf.resize(output.pos);
+      if(!buf.empty() && !sb.filled_bufs.push(std::move(buf)))
+	break;
+    }
+    ZSTD_freeDCtx(dctx);
+    fclose(fp);
+    return;
+  }
+#endif
+  run_command(f == Format::gzip ? "gzip" : "zstd", fname);
+}
+
+// run "cmd -dc -- fname" and read its standard output through a pipe
+// (read() and close() here are the POSIX functions, not istream's members, hence "::")
+void Decompressing_istream::run_command(const char* cmd, const string& fname){
+  int fds[2];
+  if(pipe(fds) != 0)
+    throw runtime_error("Error: cannot create a pipe to run " + string(cmd));
+  pid_t pid = fork();
+  if(pid < 0)
+    throw runtime_error("Error: cannot run " + string(cmd));
+  if(pid == 0){
+    // child process: connect stdout to the pipe and run the command.
+    dup2(fds[1], 1);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    execlp(cmd, cmd, "-dc", "--", fname.c_str(), (char*)nullptr);
+    _exit(127);			// exec failed
+  }
+  ::close(fds[1]);
+  {
+    lock_guard<mutex> lock{child_m};
+    child = pid;
+  }
+
+  vector<char> buf;
+  while(sb.free_bufs.pop(buf)){
+    buf.resize(Queue_streambuf::buf_size);
+    size_t n{0};
+    // fill the buffer as much as possible, so that each buffer passed to the parse thread is large
+    while(n < buf.size()){
+      ssize_t r = ::read(fds[0], buf.data()+n, buf.size()-n);
+      if(r < 0 && errno == EINTR)
+	continue;
+      if(r <= 0)
+	break;
+      n += r;
+    }
+    buf.resize(n);
+    if(n == 0 || !sb.filled_bufs.push(std::move(buf)))
+      break;
+  }
+  ::close(fds[0]);
+
+  {
+    lock_guard<mutex> lock{child_m};
+    child = -1;
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 127)
+      throw runtime_error("Error: cannot run " + string(cmd) + " to read " + fname);
+    throw runtime_error("Error in decompressing " + fname + " with " + string(cmd));
+  }
+}
+
+// Open a timeline file. A gzip or zstd file (found by its first bytes, not by the file extension) is decompressed
+// while it's read.
+unique_ptr<istream> open_input(const string& fname){
+  unique_ptr<ifstream> ifs{new ifstream{fname, ios_base::binary}};
+  if(!*ifs)
+    throw invalid_argument("Error: cannot open file " + fname);
+  unsigned char magic[4]{};
+  ifs->read((char*)magic, 4);
+  if(ifs->gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return unique_ptr<istream>{new Decompressing_istream{fname, Decompressing_istream::Format::gzip}};
+  if(ifs->gcount() == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    return unique_ptr<istream>{new Decompressing_istream{fname, Decompressing_istream::Format::zstd}};
+  ifs->clear();
+  ifs->seekg(0);
+  return ifs;
+}
+
+// ############################################################
+// Pipeline mode (--pipeline)
+// ############################################################
+
+// In the normal mode, reading (getline()), parsing (operator>>()) and aggregation (Ingest) are done one after another
+// in one thread. In the pipeline mode, they are done by different threads at the same time:
+//   reader thread --(text blocks)--> parser threads --(parsed Timelines)--> aggregator (the calling thread)
+// - The reader reads large blocks (block_size bytes) of the file. When the program is compiled with -DUSE_IO_URING
+//   (and -luring), two reads are kept in flight with io_uring. Otherwise the reader uses pread(), and the next pread()
+//   overlaps the parsing of the blocks already passed to the parser threads.
+// - Blocks are given to the parser threads in turn (block 0 to parser 0, block 1 to parser 1, ...) and the aggregator
+//   takes the parsed blocks in the same turn, so the timelines are aggregated in the original order.
+// - The stages are connected with lock-free single-producer single-consumer queues (Spsc_queue) of a fixed capacity,
+//   so the memory between the stages is bounded (about (queue_capacity+2) * block_size per parser thread).
+// - Each stage records its busy time and its waiting time on the queues (shown with --stats).
+
+// Lock-free single-producer single-consumer ring buffer. Only one thread may call try_push() and only one thread may
+// call try_pop(). head and tail are placed on different cache lines so that the two threads don't disturb each other.
+template<class T>
+class Spsc_queue {
+public:
+  Spsc_queue(size_t cap) : head{0}, tail{0} {
+    size_t n{1};
+    while(n < cap)
+      n <<= 1;
+    slots.resize(n);
+    mask = n-1;
+  }
+
+  bool try_push(T& v){		// moves v into the queue on success
+    size_t t = tail.load(memory_order_relaxed);
+    if(t - head.load(memory_order_acquire) > mask)
+      return false;		// full
+    slots[t & mask] = move(v);
+    tail.store(t+1, memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T& v){
+    size_t h = head.load(memory_order_relaxed);
+    if(h == tail.load(memory_order_acquire))
+      return false;		// empty
+    v = move(slots[h & mask]);
+    head.store(h+1, memory_order_release);
+    return true;
+  }
+
+private:
+  vector<T> slots;
+  size_t mask;
+  alignas(64) atomic<size_t> head; // next slot to pop (written only by the consumer)
+  alignas(64) atomic<size_t> tail; // next slot to push (written only by the producer)
+};
+
+// Lock-free multiple-producer single-consumer queue (D. Vyukov's intrusive node queue), used by count_times::Live_log.
+// push() may be called from any thread at the same time and never waits: a producer swaps its node into head with one
+// atomic exchange and then links it from the previous node. Only one thread may call try_pop(). It may miss a node
+// whose producer is between these two steps, and then gets it in the next call. Unlike Spsc_queue, it's unbounded
+// (a node is allocated per item), as the producers are apps that must not block.
+template<class T>
+class Mpsc_queue {
+  struct Node {
+    atomic<Node*> next{nullptr};
+    T v;
+  };
+
+public:
+  Mpsc_queue() : head{&stub}, tail{&stub} {}
+  ~Mpsc_queue(){
+    T v;
+    while(try_pop(v))
+      ;
+    if(tail != &stub)
+      delete tail;
+  }
+  Mpsc_queue(const Mpsc_queue&) = delete;
+  Mpsc_queue& operator=(const Mpsc_queue&) = delete;
+
+  void push(T v){
+    Node* n = new Node;
+    n->v = move(v);
+    Node* prev = head.exchange(n, memory_order_acq_rel);
+    prev->next.store(n, memory_order_release);
+  }
+
+  bool try_pop(T& v){
+    Node* next = tail->next.load(memory_order_acquire);
+    if(!next)
+      return false;		// empty (or the last push is not linked yet)
+    v = move(next->v);
+    // next becomes the new dummy node at the tail. The old one is freed (except the stub, a member)
+    if(tail != &stub)
+      delete tail;
+    tail = next;
+    return true;
+  }
+
+  bool empty() const {return !tail->next.load(memory_order_acquire);} // (only for the consumer)
+
+private:
+  Node stub;
+  alignas(64) atomic<Node*> head; // the last pushed node (written by the producers)
+  alignas(64) Node* tail;	  // the last popped node (only the consumer)
+};
+
+// Versioned snapshots of a value updated by one writer thread and read by any number of threads at the same time
+// (used by count_times::Live_log for its totals), RCU style: a published snapshot is never modified while someone
+// reads it.
+// The writer copies the value into one of the slots that is neither the current one nor pinned by a reader, and then
+// makes it current. A reader pins the current slot by incrementing its reader count and checking that it's still the
+// current one (if not, the writer may be overwriting it, so the reader unpins it and tries the new current one).
+// Neither side takes a lock, and the readers never make the writer wait: when all the other slots are pinned (by
+// readers keeping old snapshots), publish() returns false and the writer tries again later, so the snapshot is only
+// older for a while.
+template<class T>
+class Snapshot_store {
+  struct Slot {
+    atomic<int> readers{0};
+    uint64_t version{0};
+    T value;
+  };
+
+public:
+  static const int n_slots = 4;
+
+  // a pinned snapshot. It doesn't change until it's destroyed.
+  class Snapshot {
+  public:
+    Snapshot(Snapshot&& o) : slot{o.slot} {o.slot = nullptr;}
+    Snapshot& operator=(Snapshot&& o){
+      swap(slot, o.slot);
+      return *this;
+    }
+    ~Snapshot(){
+      if(slot)
+	slot->readers.fetch_sub(1, memory_order_release); // (our reads of value happen before the writer's next copy)
+    }
+    const T& operator*() const {return slot->value;}
+    const T* operator->() const {return &slot->value;}
+    uint64_t version() const {return slot->version;} // the version given to publish()
+
+  private:
+    friend class Snapshot_store;
+    explicit Snapshot(Slot* s) : slot{s} {}
+    Slot* slot;
+  };
+
+  Snapshot_store() : current{0} {}
+  Snapshot_store(const Snapshot_store&) = delete;
+  Snapshot_store& operator=(const Snapshot_store&) = delete;
+
+  Snapshot read() const;
+  bool publish(const T& v, uint64_t version); // only from the writer thread. false: all the other slots are pinned
+
+private:
+  mutable Slot slots[n_slots];	// (slots[0] is the first current one, with a default T and version 0)
+  atomic<int> current;
+};
+
+template<class T>
+typename Snapshot_store<T>::Snapshot Snapshot_store<T>::read() const {
+  for(;;){
+    int i = current.load();
+    slots[i].readers.fetch_add(1);
+    if(current.load() == i)
+      return Snapshot{&slots[i]};
+    slots[i].readers.fetch_sub(1);
+  }
+}
+
+template<class T>
+bool Snapshot_store<T>::publish(const T& v, uint64_t version){
+  int cur = current.load(memory_order_relaxed); // (only the writer changes current)
+  for(int k=1; k<n_slots; ++k){
+    Slot& s = slots[(cur+k) % n_slots];
+    if(s.readers.load() == 0){
+      // A reader pinning s from now on sees that s is not current and unpins it without reading.
+      s.value = v;
+      s.version = version;
+      current.store((cur+k) % n_slots);
+      return true;
+    }
+  }
+  return false;
+}
+
+// time measurement of one pipeline stage
+struct Stage_stats {
+  string name;
+  size_t items{0};		// blocks (reader) or timelines (parsers, aggregator)
+  size_t bytes{0};
+  chrono::nanoseconds busy{0}, wait{0};
+};
+
+// Waiting of a pipeline stage for its queue. The queues have no lock to block on, so a waiting stage first yields a
+// few times (the other stage is usually about to push or pop), and then sleeps, doubling the sleep up to 1 ms. So a
+// stage waiting for a slow source (e.g. a pipe of a decompressor) doesn't keep a core busy, and a hand-off in a busy
+// pipeline costs no sleep.
+struct Backoff {
+  int n{0};
+  void wait(){
+    if(n < 64)
+      this_thread::yield();
+    else
+      this_thread::sleep_for(chrono::microseconds(1 << min(n - 64, 10)));
+    ++n;
+  }
+};
+
+// wait until v is pushed to q (or the pipeline is aborted). The waiting time is added to st.wait.
+template<class T>
+bool push_wait(Spsc_queue<T>& q, T& v, const atomic<bool>& abort, Stage_stats& st){
+  if(q.try_push(v))
+    return true;
+  auto t0 = chrono::steady_clock::now();
+  for(Backoff b; !q.try_push(v); b.wait())
+    if(abort.load(memory_order_acquire))
+      return false;
+  st.wait += chrono::steady_clock::now() - t0;
+  return true;
+}
+
+template<class T>
+bool pop_wait(Spsc_queue<T>& q, T& v, const atomic<bool>& abort, Stage_stats& st){
+  if(q.try_pop(v))
+    return true;
+  auto t0 = chrono::steady_clock::now();
+  for(Backoff b; !q.try_pop(v); b.wait())
+    if(abort.load(memory_order_acquire))
+      return false;
+  st.wait += chrono::steady_clock::now() - t0;
+  return true;
+}
+
+// A source of raw blocks of a file for the reader thread. next() fills buf (buf.size() is set to the number of bytes
+// read) and returns false at the end of the file.
+struct Block_source {
+  virtual bool next(vector<char>& buf) = 0;
+  virtual ~Block_source(){}
+};
+
+// Reads a plain file with pread() (or io_uring)
+class Pread_source : public Block_source {
+public:
+  Pread_source(const string& fname, size_t bsize);
+  ~Pread_source();
+  bool next(vector<char>& buf) override;
+
+private:
+  int fd;
+  size_t block_size;
+  off_t offset;			// offset of the next block to be read
+#ifdef USE_IO_URING
+  io_uring ring;
+  vector<char> inflight[2];	// buffers of the two reads in flight
+  off_t inflight_off[2];
+  bool done[2];			// the read is completed (and its result is in done_res)
+  int done_res[2];
+  int oldest;			// index of the read to be completed next
+  void submit(int k);
+#endif
+};
+
+Pread_source::Pread_source(const string& fname, size_t bsize) : block_size{bsize}, offset{0} {
+  fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw invalid_argument("Error: cannot open file " + fname);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // let the kernel read ahead
+#ifdef USE_IO_URING
+  if(io_uring_queue_init(4, &ring, 0) < 0){
+    ::close(fd);
+    throw runtime_error("Error: cannot initialize io_uring");
+  }
+  oldest = 0;
+  done[0] = done[1] = false;
+  submit(0);
+  submit(1);
+#endif
+}
+
+Pread_source::~Pread_source(){
+#ifdef USE_IO_URING
+  io_uring_queue_exit(&ring);	// this also cancels the reads still in flight
+#endif
+  ::close(fd);
+}
+
+#ifdef USE_IO_URING
+// start reading the next block into inflight[k]
+void Pread_source::submit(int k){
+  inflight[k].resize(block_size);
+  inflight_off[k] = offset;
+  offset += block_size;
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+  io_uring_prep_read(sqe, fd, inflight[k].data(), block_size, inflight_off[k]);
+  io_uring_sqe_set_data(sqe, &inflight[k]);
+  io_uring_submit(&ring);
+}
+
+bool Pread_source::next(vector<char>& buf){
+  // Completions may come in any order, but blocks must be returned in order of offset. So wait until the oldest read
+  // is completed (a newer completion seen meanwhile is remembered in done[]).
+  while(!done[oldest]){
+    io_uring_cqe* cqe;
+    if(io_uring_wait_cqe(&ring, &cqe) < 0)
+      throw runtime_error("Error in reading a file with io_uring");
+    int k = (vector<char>*)io_uring_cqe_get_data(cqe) == &inflight[0] ? 0 : 1;
+    done[k] = true;
+    done_res[k] = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+  }
+  done[oldest] = false;
+  int res = done_res[oldest];
+  if(res < 0)
+    throw runtime_error("Error in reading a file with io_uring: " + string(strerror(-res)));
+  if(res == 0)
+    return false;
+  size_t n = res;
+  if(n < block_size){
+    // a short read (not necessarily at the end of the file). Read the rest synchronously.
+    ssize_t r;
+    while(n < block_size && (r = pread(fd, inflight[oldest].data()+n, block_size-n, inflight_off[oldest]+n)) > 0)
+      n += r;
+  }
+  inflight[oldest].resize(n);
+  swap(buf, inflight[oldest]);	// hand over the buffer without copying it
+  submit(oldest);		// reuse the slot for the block after the other read in flight
+  oldest ^= 1;
+  return true;
+}
+#else
+bool Pread_source::next(vector<char>& buf){
+  buf.resize(block_size);
+  size_t n{0};
+  while(n < block_size){
+    ssize_t r = pread(fd, buf.data()+n, block_size-n, offset+n);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r < 0)
+      throw runtime_error("Error in reading a file: " + string(strerror(errno)));
+    if(r == 0)
+      break;
+    n += r;
+  }
+  offset += n;
+  buf.resize(n);
+  return n > 0;
+}
+#endif
+
+// Reads blocks from an istream (used for compressed files, which are already decompressed in another thread)
+class Istream_source : public Block_source {
+public:
+  Istream_source(unique_ptr<istream> in, size_t bsize) : is{move(in)}, block_size{bsize} {}
+  bool next(vector<char>& buf) override {
+    buf.resize(block_size);
+    is->read(buf.data(), block_size);
+    buf.resize(is->gcount());
+    return !buf.empty();
+  }
+
+private:
+  unique_ptr<istream> is;
+  size_t block_size;
+};
+
+// A block of whole lines: carry (the unfinished last line of the previous block) + data[0, end)
+struct Text_block {
+  size_t seq{0};
+  string carry;
+  vector<char> data;
+  size_t end{0};
+  bool last{false};		// end marker
+};
+
+// Parsed timelines of one Text_block
+struct Record_batch {
+  size_t seq{0};
+  string header;		// the date line (only in the batch of block 0)
+  vector<Timeline> records;
+  vector<pair<size_t, string>> dates; // date lines in the middle: (the index of the record after it, the line)
+  int error_index{-1};		// index of the first line that failed to be read, or -1
+  bool last{false};
+};
+
+class Pipeline {
+public:
+  static const size_t block_size = 1<<20;
+  static const size_t queue_capacity = 4;
+
+  Pipeline(unique_ptr<Block_source> src, int n_parsers);
+  ~Pipeline();			// stops and joins the threads, even when aggregate() exits by an exception
+
+  // run the aggregator stage in this thread. Returns false when a timeline cannot be read (the error is printed).
+  bool aggregate(Aggregate& agg, const vector<Entry_listener>& listeners = {});
+  void print_stats(ostream& os) const;
+
+private:
+  unique_ptr<Block_source> source;
+  int n;
+  atomic<bool> abort;
+  vector<unique_ptr<Spsc_queue<Text_block>>> in_q;
+  vector<unique_ptr<Spsc_queue<Record_batch>>> out_q;
+  vector<Stage_stats> stats;	// [0]: reader, [1..n]: parsers, [n+1]: aggregator
+  vector<thread> threads;
+  exception_ptr error;		// exception in the reader/parser threads
+  mutex error_m;
+
+  void run_reader();
+  void run_parser(int k);
+  void fail(exception_ptr e);
+};
+
+Pipeline::Pipeline(unique_ptr<Block_source> src, int n_parsers) : source{move(src)}, n{max(1, n_parsers)}, abort{false} {
+  stats.resize(n+2);
+  stats[0].name = "reader";
+  for(int k=0; k<n; ++k){
+    in_q.emplace_back(new Spsc_queue<Text_block>{queue_capacity});
+    out_q.emplace_back(new Spsc_queue<Record_batch>{queue_capacity});
+    stats[k+1].name = "parser " + to_string(k);
+  }
+  stats[n+1].name = "aggregator";
+  threads.emplace_back(&Pipeline::run_reader, this);
+  for(int k=0; k<n; ++k)
+    threads.emplace_back(&Pipeline::run_parser, this, k);
+}
+
+Pipeline::~Pipeline(){
+  abort = true;
+  for(thread& t : threads)
+    t.join();
+}
+
+void Pipeline::fail(exception_ptr e){
+  lock_guard<mutex> lock{error_m};
+  if(!error)
+    error = e;
+  abort = true;
+}
+
+void Pipeline::run_reader(){
+  Stage_stats& st = stats[0];
+  try{
+    string carry;
+    size_t seq{0};
+    vector<char> buf;
+    while(true){
+      auto t0 = chrono::steady_clock::now();
+      if(!source->next(buf))
+	break;
+      Text_block b;
+      b.seq = seq;
+      b.carry = move(carry);
+      // cut the block at the last newline. The rest (an unfinished line) goes to the next block.
+      size_t end = buf.size();
+      while(end > 0 && buf[end-1] != '\n')
+	--end;
+      carry.assign(buf.data()+end, buf.size()-end);
+      if(end == 0){
+	// no newline in this block (a very long line). Join it to the carry and read more.
+	carry.insert(0, b.carry);
+	continue;
+      }
+      st.bytes += buf.size();
+      b.end = end;
+      b.data = move(buf);
+      buf = vector<char>();
+      ++st.items;
+      st.busy += chrono::steady_clock::now() - t0;
+      if(!push_wait(*in_q[seq % n], b, abort, st))
+	return;
+      ++seq;
+    }
+    // the last line without a newline at the end of the file
+    if(!carry.empty()){
+      Text_block b;
+      b.seq = seq;
+      b.carry = move(carry);
+      if(!push_wait(*in_q[seq % n], b, abort, st))
+	return;
+      ++seq;
+    }
+    // send end markers to all parsers, starting from the one whose turn is next
+    for(int k=0; k<n; ++k){
+      Text_block b;
+      b.seq = seq;
+      b.last = true;
+      if(!push_wait(*in_q[(seq+k) % n], b, abort, st))
+	return;
+    }
+  }
+  catch(...){
+    fail(current_exception());
+  }
+}
+
+void Pipeline::run_parser(int k){
+  Stage_stats& st = stats[k+1];
+  try{
+    // See the comment at the global "date". The reference date of sub-activity time stamps doesn't affect durations.
+    date = tm{};
+    date.tm_year = 70; date.tm_mday = 1;
+    
+    Text_block b;
+    while(pop_wait(*in_q[k], b, abort, st)){
+      auto t0 = chrono::steady_clock::now();
+      Record_batch r;
+      r.seq = b.seq;
+      r.last = b.last;
+      if(!b.last){
+	string line{move(b.carry)};
+	const char* p = b.data.data();
+	const char* end = p + b.end;
+	bool first_line = b.seq == 0;
+	bool pending = !line.empty() || p == end; // the carry is the beginning of the first line
+	while(p < end || pending){
+	  const char* nl = find(p, end, '\n');
+	  line.append(p, nl);
+	  p = nl < end ? nl+1 : end;
+	  pending = false;
+	  if(first_line){
+	    r.header = move(line);
+	    first_line = false;
+	  }
+	  else if(normalize_utf8(line), is_date_line(line))
+	    r.dates.push_back({r.records.size(), move(line)});
+	  else{
+	    istringstream iss{line};
+	    Timeline tl;
+	    if(!(iss >> tl)){
+	      r.error_index = r.records.size();
+	      break;
+	    }
+	    r.records.push_back(move(tl));
+	  }
+	  line.clear();
+	}
+	st.items += r.records.size();
+	st.bytes += b.end + b.carry.size();
+      }
+      st.busy += chrono::steady_clock::now() - t0;
+      bool last = b.last;
+      if(!push_wait(*out_q[k], r, abort, st) || last)
+	return;
+    }
+  }
+  catch(...){
+    fail(current_exception());
+  }
+}
+
+bool Pipeline::aggregate(Aggregate& agg, const vector<Entry_listener>& listeners){
+  Stage_stats& st = stats[n+1];
+  Ingest ingest{agg, listeners};
+  bool has_header{false};
+  for(size_t seq=0; ; ++seq){
+    Record_batch r;
+    if(!pop_wait(*out_q[seq % n], r, abort, st))
+      break;
+    auto t0 = chrono::steady_clock::now();
+    if(seq == 0){
+      // the first line is the date (an empty file doesn't even have it, and read_date() reports it)
+      if(!ingest.read_date(r.header))
+	return false;
+      has_header = true;
+    }
+    if(r.last)
+      break;
+    auto date_line = r.dates.begin();
+    for(size_t i=0; i<=r.records.size(); ++i){
+      for(; date_line != r.dates.end() && date_line->first == i; ++date_line)
+	if(!ingest.restart(date_line->second))
+	  return false;
+      if(i < r.records.size())
+	ingest.add(move(r.records[i]));
+    }
+    st.items += r.records.size();
+    st.busy += chrono::steady_clock::now() - t0;
+    if(r.error_index >= 0){
+      cerr << "At " << ingest.c << "-th Timeline, an reading error happened\n";
+      return false;
+    }
+  }
+  // (fail() sets error under error_m, so it's read under error_m, too. A stopped stage has always set it before abort)
+  exception_ptr e;
+  {
+    lock_guard<mutex> lock{error_m};
+    e = error;
+  }
+  if(e)
+    rethrow_exception(e);
+  return has_header;
+}
+
+void Pipeline::print_stats(ostream& os) const {
+  os << "Pipeline stages (" << n << " parser thread" << (n > 1 ? "s" : "") << ", " << block_size/1024
+     << " KiB blocks, queue capacity " << queue_capacity << "):" << endl;
+  for(const Stage_stats& st : stats){
+    os << "\t" << st.name << ": " << st.items << (&st == &stats[0] ? " blocks, " : " timelines, ")
+       << st.bytes << " bytes, busy " << chrono::duration_cast<chrono::microseconds>(st.busy).count()
+       << " us, waiting " << chrono::duration_cast<chrono::microseconds>(st.wait).count() << " us" << endl;
+  }
+}
+
+// read a timeline file with the pipeline. Compressed files are read from their decompressing istream.
+bool read_timeline_file_pipelined(const string& fname, Aggregate& agg, int n_parsers, bool show_stats,
+				  const vector<Entry_listener>& listeners = {}){
+  unique_ptr<Block_source> src;
+  unique_ptr<istream> in = open_input(fname);
+  if(dynamic_cast<ifstream*>(in.get())){
+    in.reset();			// a plain file. Read it with pread() instead
+    src.reset(new Pread_source{fname, Pipeline::block_size});
+  }
+  else
+    src.reset(new Istream_source{move(in), Pipeline::block_size});
+
+  Pipeline p{move(src), n_parsers};
+  bool ok = p.aggregate(agg, listeners);
+  if(show_stats)
+    p.print_stats(cerr);
+  return ok;
+}
+
+// ############################################################
+// Merging the timelines of several devices (--merge-devices)
+// ############################################################
+
+// The timelines of one timeline file, read one by one, with their end times resolved (dated) as usual.
+// Each file has its own date line, so each stream keeps its own copy of the global date (like Entry_range).
+class Timeline_stream {
+public:
+  explicit Timeline_stream(const string& fname);
+  bool next();			// read the next timeline. false at the end of the file
+  Timeline& timeline(){return ingest.prev;} // the timeline read by next() (Ingest swaps it into prev)
+  time_t end(){return timegm(&ingest.prev.end_t);}
+  int line_num() const {return ingest.c;} // the line number of the timeline in the file (line 1 is the date)
+  bool starting_point() const {return restarted;} // the timeline follows a date line (its interval isn't counted)
+
+private:
+  string fname;
+  unique_ptr<istream> in;
+  Aggregate agg;		// Ingest needs it, although only the dated timelines are used here
+  Ingest ingest;
+  string line;
+  tm file_date;
+  bool restarted{true};
+};
+
+Timeline_stream::Timeline_stream(const string& fname)
+  : fname{fname}, in{open_input(fname)}, ingest{agg}
+{
+  tm saved = date;
+  if(!getline(*in, line) || !ingest.read_date(line)){
+    date = saved;
+    throw runtime_error("Error in reading the date line of " + fname);
+  }
+  file_date = date;
+  date = saved;
+}
+
+bool Timeline_stream::next(){
+  bool is_timeline{false};
+  restarted = false;
+  while(!is_timeline){		// (skip date lines in the middle, but remember them)
+    if(!getline(*in, line))
+      return false;
+    tm saved = date;
+    date = file_date;
+    bool ok = ingest.feed(line);
+    file_date = date;
+    date = saved;
+    if(!ok)
+      throw runtime_error("Error in reading " + fname);
+    is_timeline = !is_date_line(line);
+    restarted = restarted || !is_timeline;
+  }
+  return true;
+}
+
+// Count the timeline files of several devices (e.g. a phone and a laptop) covering the same days as one timeline:
+// the timelines of all files are merged in the order of their end times with a min-heap of one timeline per file,
+// so only one timeline per file is in memory at a time. The interval of a timeline then starts at the previous
+// timeline of the merged stream, whichever file it came from.
+// Conflicts are resolved in a fixed way, so the result doesn't depend on anything but the files and their order:
+//  - timelines with the same end time are taken in the order of the files on the command line, and when two
+//    files have a timeline with the same end time, only the one of the earliest file is counted (the same entry
+//    logged on both devices)
+//  - when sub-activities don't fit in the merged (shorter) interval, they are shortened from the last one
+//  - a date line in the middle of a file starts again from there as in Ingest::restart(), when no other file has a
+//    timeline since the file's previous timeline (otherwise, the interval starts at that other timeline as usual)
+// Errors are thrown as runtime_error.
+void read_device_files(const vector<string>& fnames, Aggregate& agg, const vector<Entry_listener>& listeners = {}){
+  vector<unique_ptr<Timeline_stream>> streams;
+  struct Head {time_t end; size_t file; int line_num;};
+  auto later = [](const Head& x, const Head& y){ // for a min-heap
+    return x.end > y.end || (x.end == y.end && (x.file > y.file || (x.file == y.file && x.line_num > y.line_num)));
+  };
+  vector<Head> heap;
+  for(size_t k=0; k<fnames.size(); ++k){
+    streams.emplace_back(new Timeline_stream{fnames[k]});
+    if(streams[k]->next())
+      heap.push_back({streams[k]->end(), k, streams[k]->line_num()});
+  }
+  make_heap(heap.begin(), heap.end(), later);
+
+  Ingest merged{agg, listeners};
+  merged.clip_subs = true;
+  int n_duplicates{0};
+  bool first{true};
+  time_t last_end{0};
+  size_t last_file{0};
+  while(!heap.empty()){
+    pop_heap(heap.begin(), heap.end(), later);
+    Head h = heap.back();
+    heap.pop_back();
+    Timeline_stream& st = *streams[h.file];
+    if(!first && h.end == last_end && h.file != last_file)
+      ++n_duplicates;
+    else{
+      if(!first && h.file == last_file && st.starting_point())
+	merged.first_c = merged.c; // the timeline after a date line is only the starting point
+      merged.add_dated(Timeline{st.timeline()});
+      last_end = h.end;
+      last_file = h.file;
+      first = false;
+    }
+    if(st.next())
+      heap.push_back({st.end(), h.file, st.line_num()});
+    push_heap(heap.begin(), heap.end(), later);
+  }
+  if(n_duplicates || merged.n_clipped)
+    cerr << "Merged " << fnames.size() << " files: " << n_duplicates << " timelines with the same time stamp as "
+	 << "another file's were skipped, and the sub-activities of " << merged.n_clipped
+	 << " timelines were shortened to fit" << endl;
+}
+
+// ############################################################
+// Interval index (--at, --overlaps)
+// ############################################################
+
+// One resolved interval [begin, end) of a main activity or a time-stamped sub-activity
+struct Interval {
+  time_t begin, end;
+  activity_type a;
+  int task_num;
+  bool sub;			// true for a sub-activity
+  int file;			// index of the input file
+  int line_num;			// the timeline number (c in Ingest) in the file
+};
+
+// All intervals of the input files, kept in an implicit interval tree (the same layout as cgranges by Heng Li):
+// the intervals are sorted by begin, and the sorted array itself is regarded as a balanced binary search tree, where
+// the element i is a node of level k if i has exactly k trailing 1 bits (leaves are the even indexes, and the root is
+// at 2^K - 1). Each node also stores max_end, the maximum end of its subtree, so a query can skip the subtrees that
+// end before the queried time. A point or overlap query takes O(log n + number of hits) time, and the index needs
+// only one extra time_t per interval.
+class Interval_index {
+public:
+  void add(const Interval& iv){intervals.push_back(iv); max_level = -2;}
+  void build();			// call after all intervals are added
+
+  // intervals that overlap [b, e). For a point-in-time query, use [t, t+1).
+  vector<const Interval*> overlap(time_t b, time_t e) const;
+
+  const vector<Interval>& all() const {return intervals;}
+
+private:
+  vector<Interval> intervals;
+  vector<time_t> max_end;
+  int max_level{-2};		// -2: not built yet, -1: empty
+};
+
+void Interval_index::build(){
+  sort(intervals.begin(), intervals.end(), [](const Interval& x, const Interval& y){
+    return x.begin < y.begin || (x.begin == y.begin && x.end < y.end);
+  });
+  size_t n = intervals.size();
+  max_end.assign(n, 0);
+  if(n == 0){
+    max_level = -1;
+    return;
+  }
+  // leaves
+  size_t last_i{0};
+  time_t last{0};
+  for(size_t i=0; i<n; i+=2){
+    last_i = i;
+    last = max_end[i] = intervals[i].end;
+  }
+  // internal nodes, level by level. A node whose right child is beyond the array uses "last", the max_end of the
+  // rightmost existing node of the level below.
+  int k;
+  for(k=1; (size_t(1) << k) <= n; ++k){
+    size_t x = size_t(1) << (k-1), i0 = (x << 1) - 1, step = x << 2;
+    for(size_t i=i0; i<n; i+=step){
+      time_t el = max_end[i-x];
+      time_t er = i+x < n ? max_end[i+x] : last;
+      max_end[i] = max(intervals[i].end, max(el, er));
+    }
+    last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+    if(last_i < n && max_end[last_i] > last)
+      last = max_end[last_i];
+  }
+  max_level = k-1;
+}
+
+vector<const Interval*> Interval_index::overlap(time_t b, time_t e) const {
+  if(max_level == -2)
+    throw runtime_error("Error: Interval_index::overlap() is called before build()");
+  vector<const Interval*> hits;
+  if(max_level < 0)
+    return hits;
+  size_t n = intervals.size();
+  struct Frame {size_t x; int k; bool visited_left;};
+  vector<Frame> stack{{(size_t(1) << max_level) - 1, max_level, false}};
+  while(!stack.empty()){
+    Frame z = stack.back();
+    stack.pop_back();
+    if(z.k <= 3){
+      // a small subtree. Scanning it linearly is faster than going down further.
+      size_t i0 = z.x >> z.k << z.k, i1 = min(i0 + (size_t(1) << (z.k+1)) - 1, n);
+      for(size_t i=i0; i<i1 && intervals[i].begin < e; ++i)
+	if(b < intervals[i].end)
+	  hits.push_back(&intervals[i]);
+    }
+    else if(!z.visited_left){
+      // visit the left subtree first, unless every interval in it ends before b
+      size_t y = z.x - (size_t(1) << (z.k-1));
+      stack.push_back({z.x, z.k, true});
+      if(y >= n || max_end[y] > b)
+	stack.push_back({y, z.k-1, false});
+    }
+    else if(z.x < n && intervals[z.x].begin < e){
+      // this node, then the right subtree (all intervals there begin at or after this node's begin)
+      if(b < intervals[z.x].end)
+	hits.push_back(&intervals[z.x]);
+      stack.push_back({z.x + (size_t(1) << (z.k-1)), z.k-1, false});
+    }
+  }
+  return hits;
+}
+
+// add the main activity and the time-stamped sub-activities of a resolved entry to the index
+void add_to_interval_index(Interval_index& index, const Resolved_entry& re, int file){
+  index.add({re.begin, re.end, re.tl->get_a(), re.tl->task_num, false, file, re.line_num});
+  for(const Resolved_entry::Sub_interval& s : re.sub_intervals)
+    index.add({s.begin, s.end, s.a, s.task_num, true, file, re.line_num});
+}
+
+string format_time(time_t t){
+  char buff[20];		// e.g. "2024-12-24 19:27"
+  strftime(buff, sizeof(buff), "%F %H:%M", gmtime(&t));
+  return buff;
+}
+
+void print_interval(ostream& os, const Interval& iv, const vector<string>& fnames){
+  os << (iv.sub ? "sub-activity " : "") << convert_a2s(iv.a);
+  if(iv.a == activity_type::task && iv.task_num)
+    os << " " << iv.task_num;
+  os << ", " << format_time(iv.begin) << " - " << format_time(iv.end)
+     << " (" << fnames[iv.file] << ", " << iv.line_num << "-th Timeline)" << endl;
+}
+
+// answer "what was I doing at t?"
+void print_point_query(ostream& os, const Interval_index& index, time_t t, const vector<string>& fnames){
+  os << "At " << format_time(t) << ":" << endl;
+  vector<const Interval*> hits = index.overlap(t, t+1);
+  if(hits.empty())
+    os << "\tno record" << endl;
+  for(const Interval* iv : hits){
+    os << "\t";
+    print_interval(os, *iv, fnames);
+  }
+}
+
+// list the sub-activities sticking out of their main activity's span, and the sub-activities overlapping each other
+void print_overlaps(ostream& os, const Interval_index& index, const vector<string>& fnames){
+  os << "Sub-activities outside their main activity:" << endl;
+  int n_out{0}, n_overlap{0};
+  for(const Interval& iv : index.all()){
+    if(!iv.sub)
+      continue;
+    // the main activity of this sub-activity is the main interval with the same file and line number
+    bool inside{false};
+    for(const Interval* m : index.overlap(iv.begin, iv.end))
+      if(!m->sub && m->file == iv.file && m->line_num == iv.line_num)
+	inside = m->begin <= iv.begin && iv.end <= m->end;
+    if(!inside){
+      os << "\t";
+      print_interval(os, iv, fnames);
+      ++n_out;
+    }
+  }
+  if(n_out == 0)
+    os << "\tnone" << endl;
+
+  os << "Overlapping sub-activities:" << endl;
+  for(const Interval& iv : index.all()){
+    if(!iv.sub)
+      continue;
+    for(const Interval* other : index.overlap(iv.begin, iv.end))
+      if(other->sub && &iv < other){ // report each pair once
+	os << "\t";
+	print_interval(os, iv, fnames);
+	os << "\t  overlaps ";
+	print_interval(os, *other, fnames);
+	++n_overlap;
+      }
+  }
+  if(n_overlap == 0)
+    os << "\tnone" << endl;
+}
+
+// ############################################################
+// Heatmap (--heatmap)
+// ############################################################
+
+// When in the day (and in the week) each activity happens.
+// Each main activity covers [begin, end) of its resolved entry, except its sub-activities. Time-stamped sub-activities
+// have their own spans, and the rest of the sub-activities' minutes (e.g. (w ~20m)) are taken from the end of the main
+// activity's span, as they have no time stamps.
+// All spans are accumulated in difference arrays over the minutes of the week (7*1440 minutes, starting from Sunday
+// 0:00): adding a span is O(1) (+1 at its start and -1 at its end, and a span longer than a week adds whole weeks to
+// "weeks"), and the minutes per bucket are obtained by a single prefix sum at the end. So years of timelines cost
+// O(entries + buckets).
+// With --where, only the main activities and sub-activities passing it are added (a main activity still leaves out
+// the spans of its sub-activities, as its minutes don't include them).
+class Heatmap {
+public:
+  static const int week_min = 7*1440;
+
+  void add(const Resolved_entry& re, const Where_filter* where); // an Entry_listener
+
+  // minutes of each activity type per minute of the week. [int(activity_type)][minute of the week]
+  vector<vector<long long>> minutes_of_week() const;
+
+private:
+  struct Diff {
+    vector<long long> d = vector<long long>(week_min + 1, 0);
+    long long weeks{0};
+  };
+  vector<Diff> diffs;		// [int(activity_type)]
+
+  void add_span(activity_type a, time_t b, time_t e, int sign); // [b, e) in seconds
+};
+
+void Heatmap::add_span(activity_type a, time_t b, time_t e, int sign){
+  auto floor_min = [](time_t t){return t >= 0 ? t/60 : (t-59)/60;};
+  long long s = floor_min(b), len = floor_min(e) - s;
+  if(len <= 0)
+    return;
+  if(int(diffs.size()) <= int(a))
+    diffs.resize(int(a)+1);
+  Diff& df = diffs[int(a)];
+  df.weeks += sign * (len / week_min);
+  len %= week_min;
+  long long start = ((s + 4*1440) % week_min + week_min) % week_min; // 1970-01-01 0:00 was Thursday 0:00
+  long long end = start + len;
+  df.d[start] += sign;
+  if(end <= week_min)
+    df.d[end] -= sign;
+  else{				// wraps around Saturday 24:00
+    df.d[week_min] -= sign;
+    df.d[0] += sign;
+    df.d[end - week_min] -= sign;
+  }
+}
+
+void Heatmap::add(const Resolved_entry& re, const Where_filter* where){
+  activity_type main_a = re.tl->get_a();
+  bool main_passes = where_passes(where, re, -1);
+  if(main_passes)
+    add_span(main_a, re.begin, re.end, 1);
+  // Only the part of a sub-activity inside the main activity's span is taken from the main activity (time-stamped
+  // sub-activities may stick out of it).
+  for_each_sub_span(re, [this, &re, where, main_a, main_passes](activity_type a, int, time_t b, time_t e, bool, int sub){
+    if(where_passes(where, re, sub))
+      add_span(a, b, e, 1);
+    if(main_passes)
+      add_span(main_a, max(b, re.begin), min(e, re.end), -1);
+  });
+}
+
+vector<vector<long long>> Heatmap::minutes_of_week() const {
+  vector<vector<long long>> m(diffs.size());
+  for(size_t a=0; a<diffs.size(); ++a){
+    m[a].assign(week_min, 0);
+    long long cur{0};
+    for(int i=0; i<week_min; ++i){
+      cur += diffs[a].d[i];
+      m[a][i] = cur + diffs[a].weeks;
+    }
+  }
+  return m;
+}
+
+// print the minutes per time of day (bucket_min-minute buckets) as a table of the activity types, and the minutes per
+// weekday and hour of each activity type
+void print_heatmap(ostream& os, const Heatmap& hm, int bucket_min){
+  static const char* day_names[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  vector<vector<long long>> m = hm.minutes_of_week();
+  vector<int> types;		// the activity types with any time
+  for(size_t a=0; a<m.size(); ++a)
+    if(any_of(m[a].begin(), m[a].end(), [](long long v){return v != 0;}))
+      types.push_back(a);
+
+  os << "Minutes per time of day (" << bucket_min << "-minute buckets):" << endl;
+  os << "time ";
+  vector<size_t> width;
+  for(int a : types){
+    string label = convert_a2s(activity_type(a));
+    width.push_back(max<size_t>(label.size(), 7));
+    os << "  " << setw(width.back()) << label;
+  }
+  os << endl;
+  for(int b=0; b<1440; b+=bucket_min){
+    os << setfill('0') << setw(2) << b/60 << ':' << setw(2) << b%60 << setfill(' ');
+    for(size_t k=0; k<types.size(); ++k){
+      long long sum{0};
+      for(int d=0; d<7; ++d)
+	for(int i=b; i<min(b+bucket_min, 1440); ++i)
+	  sum += m[types[k]][d*1440 + i];
+      os << "  " << setw(width[k]) << sum;
+    }
+    os << endl;
+  }
+
+  for(int a : types){
+    os << convert_a2s(activity_type(a)) << " (minutes per weekday and hour):" << endl;
+    os << "   ";
+    for(int h=0; h<24; ++h)
+      os << ' ' << setw(4) << h;
+    os << endl;
+    for(int d=0; d<7; ++d){
+      os << day_names[d];
+      for(int h=0; h<24; ++h){
+	long long sum{0};
+	for(int i=0; i<60; ++i)
+	  sum += m[a][d*1440 + h*60 + i];
+	os << ' ' << setw(4) << sum;
+      }
+      os << endl;
+    }
+  }
+}
+
+// ############################################################
+// Interval export (--export-intervals)
+// ############################################################
+
+// An output file written through a large buffer with write(2), so that writing many small pieces (a row is a few
+// numbers) costs a memcpy each, not a stream operation or a system call. Nothing is flushed until the buffer is full.
+// Errors are thrown as runtime_error.
+class Buffered_writer {
+public:
+  explicit Buffered_writer(const string& fname, bool append = false); // "-": stdout
+  ~Buffered_writer();
+  Buffered_writer(const Buffered_writer&) = delete;
+  Buffered_writer& operator=(const Buffered_writer&) = delete;
+
+  void put(char c){
+    if(n == buf.size())
+      flush();
+    buf[n++] = c;
+  }
+  void put(const char* s, size_t len);
+  void put(const char* s){put(s, strlen(s));}
+  void put(const string& s){put(s.data(), s.size());}
+  void put_int(long long v);		// in decimal
+  void put_le(uint64_t v, int bytes);	// little endian
+  void put_time(time_t t);		// "yyyy-mm-ddThh:mm"
+  void flush();
+  void close();				// flush and close the file
+
+private:
+  static const size_t buf_size = 1<<20;
+  string fname;
+  int fd;
+  vector<char> buf;
+  size_t n{0};			// the bytes in buf
+};
+
+Buffered_writer::Buffered_writer(const string& f, bool append)
+  : fname{f}, buf(buf_size)
+{
+  fd = f == "-" ? 1 : open(f.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+  if(fd < 0)
+    throw invalid_argument("Error: cannot open file " + f);
+}
+
+Buffered_writer::~Buffered_writer(){
+  if(fd > 1)
+    ::close(fd);		// after an error (close() was not called)
+}
+
+void Buffered_writer::put(const char* s, size_t len){
+  if(buf.size() - n < len){
+    flush();
+    if(len > buf.size()){
+      buf.resize(len);
+    }
+  }
+  memcpy(&buf[n], s, len);
+  n += len;
+}
+
+void Buffered_writer::put_int(long long v){
+  char tmp[24];
+  char* p = tmp + sizeof(tmp);
+  unsigned long long u = v < 0 ? 0ULL - v : v;
+  do{
+    *--p = '0' + u % 10;
+    u /= 10;
+  }while(u);
+  if(v < 0)
+    *--p = '-';
+  put(p, tmp + sizeof(tmp) - p);
+}
+
+void Buffered_writer::put_le(uint64_t v, int bytes){
+  char tmp[8];
+  for(int i=0; i<bytes; ++i){
+    tmp[i] = char(v & 0xff);
+    v >>= 8;
+  }
+  put(tmp, bytes);
+}
+
+void Buffered_writer::put_time(time_t t){
+  // days since 1970-01-01 -> the date, without gmtime()/strftime() (H. Hinnant's days_from_civil() reversed)
+  long long days = t >= 0 ? t/86400 : (t-86399)/86400;
+  long long sec = t - days*86400;
+  long long z = days + 719468;
+  long long era = (z >= 0 ? z : z - 146096) / 146097;
+  long long doe = z - era * 146097;
+  long long yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  long long doy = doe - (365*yoe + yoe/4 - yoe/100);
+  long long mp = (5*doy + 2)/153;
+  long long d = doy - (153*mp + 2)/5 + 1;
+  long long m = mp < 10 ? mp+3 : mp-9;
+  long long y = yoe + era * 400 + (m <= 2);
+  char s[17] = "0000-00-00T00:00";
+  auto two = [&s](int pos, long long v){s[pos] = '0' + v/10; s[pos+1] = '0' + v%10;};
+  for(int i=3; i>=0; --i, y /= 10)
+    s[i] = '0' + y % 10;
+  two(5, m);
+  two(8, d);
+  two(11, sec/3600);
+  two(14, sec/60%60);
+  put(s, 16);
+}
+
+void Buffered_writer::flush(){
+  size_t done{0};
+  while(done < n){
+    ssize_t k = write(fd, buf.data() + done, n - done);
+    if(k < 0 && errno == EINTR)
+      continue;
+    if(k <= 0)
+      throw runtime_error("Error in writing " + fname + ": " + strerror(errno));
+    done += k;
+  }
+  n = 0;
+}
+
+void Buffered_writer::close(){
+  flush();
+  if(fd > 1 && ::close(fd) != 0){
+    fd = -1;
+    throw runtime_error("Error in writing " + fname + ": " + strerror(errno));
+  }
+  fd = -1;
+}
+
+// Writes one row per resolved main activity and sub-activity (an Entry_listener), in one of the formats:
+//   csv	begin,end,type,task,sub,stamped,minutes (with this header line). begin/end are "yyyy-mm-ddThh:mm"
+//   ndjson	{"begin":"...","end":"...","type":"task","task":1,"sub":false,"stamped":true,"minutes":30} per line
+//   binary	"CTIV" (magic), version (varint), the category table (see put_categories()), then 24-byte records of
+//		begin (int64), end (int64), minutes (int32), type (uint16, an index of the category table), task
+//		(uint8), flags (uint8: 1 sub, 2 stamped), all little endian
+// type is the category id. A main activity's row spans [begin, end) of the timeline and has its minutes without its
+// sub-activities. Sub-activities without time stamps are laid out at the end of the main activity's span like in
+// --heatmap, and have stamped false. With --where, only the rows of the main activities and sub-activities passing
+// it are written.
+class Interval_exporter {
+public:
+  Interval_exporter(const string& fname, const string& format); // throws invalid_argument for an unknown format
+
+  void add(const Resolved_entry& re, const Where_filter* where); // an Entry_listener
+  void close(){w.close();}
+
+private:
+  enum class Format {csv, ndjson, binary};
+  static Format format_of(const string& f);
+  void row(time_t b, time_t e, activity_type a, int task_num, bool sub, bool stamped, long long min);
+
+  Format format;		// (before w, so that the file is not made for a wrong format)
+  Buffered_writer w;
+};
+
+Interval_exporter::Format Interval_exporter::format_of(const string& f){
+  if(f == "csv")
+    return Format::csv;
+  if(f == "ndjson")
+    return Format::ndjson;
+  if(f == "binary")
+    return Format::binary;
+  throw invalid_argument("Error: unknown format " + f + " in --export-format (csv, ndjson, binary)");
+}
+
+Interval_exporter::Interval_exporter(const string& fname, const string& f)
+  : format{format_of(f)}, w{fname}
+{
+  if(format == Format::csv)
+    w.put("begin,end,type,task,sub,stamped,minutes\n");
+  else if(format == Format::binary){
+    ostringstream oss;
+    oss.write("CTIV", 4);
+    put_varint(oss, 1);
+    put_categories(oss);
+    w.put(oss.str());
+  }
+}
+
+void Interval_exporter::add(const Resolved_entry& re, const Where_filter* where){
+  if(where_passes(where, re, -1))
+    row(re.begin, re.end, re.tl->get_a(), re.tl->task_num, false, true, re.main_min);
+  for_each_sub_span(re, [this, &re, where](activity_type a, int task_num, time_t b, time_t e, bool stamped, int sub){
+    if(where_passes(where, re, sub))
+      row(b, e, a, task_num, true, stamped, (e - b)/60);
+  });
+}
+
+void Interval_exporter::row(time_t b, time_t e, activity_type a, int task_num, bool sub, bool stamped, long long min){
+  switch(format){
+  case Format::csv:
+    w.put_time(b);
+    w.put(',');
+    w.put_time(e);
+    w.put(',');
+    w.put(taxonomy.categories[int(a)].id);
+    w.put(',');
+    w.put_int(task_num);
+    w.put(sub ? ",1," : ",0,", 3);
+    w.put(stamped ? "1," : "0,", 2);
+    w.put_int(min);
+    w.put('\n');
+    break;
+  case Format::ndjson:
+    w.put("{\"begin\":\"", 10);
+    w.put_time(b);
+    w.put("\",\"end\":\"", 9);
+    w.put_time(e);
+    w.put("\",\"type\":\"", 10);
+    w.put(taxonomy.categories[int(a)].id); // ids are identifiers (no '"' or '\\')
+    w.put("\",\"task\":", 9);
+    w.put_int(task_num);
+    w.put(sub ? ",\"sub\":true" : ",\"sub\":false");
+    w.put(stamped ? ",\"stamped\":true" : ",\"stamped\":false");
+    w.put(",\"minutes\":", 11);
+    w.put_int(min);
+    w.put("}\n", 2);
+    break;
+  case Format::binary:
+    w.put_le(b, 8);
+    w.put_le(e, 8);
+    w.put_le(uint32_t(min), 4);
+    w.put_le(int(a), 2);
+    w.put_le(task_num, 1);
+    w.put_le((sub ? 1 : 0) | (stamped ? 2 : 0), 1);
+    break;
+  }
+}
+
+// ############################################################
+// Content index (--build-index, count_times query)
+// ############################################################
+
+// An inverted index of the words in activity contents. Each timeline (entry) gets an id in the order it's read, and
+// each word has a posting list, the sorted ids of the entries containing it. The entries keep only their times, so a
+// query ("how much time did 'code review' take?") intersects the posting lists of its words and sums the times of
+// the hit entries per activity type without reading the timeline files again.
+//
+// File format (integers are LEB128 varints as in partial aggregates):
+//   "CTIX" (magic), version, the category table (put_categories())
+//   number of entries, then for each entry: end (delta from the previous entry's end), a, task_num, main minutes,
+//     number of sub-activities, (a, task_num, minutes) per sub-activity
+//   number of words, then for each word: the word, byte length of the posting list, the posting list
+// A posting list is the entry ids as varints of the deltas from the previous id, and it's kept in this compressed
+// form in memory, too (both while building and after reading), so only the lists of the queried words are decoded.
+const char index_magic[4] = {'C', 'T', 'I', 'X'};
+const unsigned index_version = 1;
+
+// split s into lowercase words of letters and digits (bytes >= 0x80 are regarded as letters, so that UTF-8 words are
+// kept as they are)
+vector<string> split_words(const string& s){
+  vector<string> words;
+  string w;
+  for(char ch : s){
+    unsigned char u = ch;
+    if(isalnum(u) || u >= 0x80)
+      w += tolower(u);
+    else if(!w.empty()){
+      words.push_back(w);
+      w.clear();
+    }
+  }
+  if(!w.empty())
+    words.push_back(w);
+  return words;
+}
+
+class Content_index {
+public:
+  void add(const Resolved_entry& re);	// an Entry_listener
+  void write(ostream& os) const;
+  void read(istream& is);
+
+  // The total times of the entries containing all the words and ending in [from, to), as an Aggregate
+  // (so that print_report() can show it)
+  Aggregate query(const vector<string>& words, time_t from, time_t to) const;
+
+  size_t size() const {return entries.size();}
+
+private:
+  struct Entry {
+    time_t end;
+    activity_type a;
+    int task_num;
+    long long main_min;
+    vector<Aggregate::Sub_minutes> subs;
+  };
+  struct Posting {
+    string bytes;		// delta-encoded entry ids
+    uint32_t last{0};		// the last id in bytes (used while building)
+    size_t n{0};		// the number of ids
+  };
+  vector<Entry> entries;
+  map<string, Posting> postings;
+
+  vector<uint32_t> decode(const Posting& p) const;
+};
+
+void Content_index::add(const Resolved_entry& re){
+  uint32_t id = entries.size();
+  Timeline& t = const_cast<Timeline&>(*re.tl); // get_subtl() is not const (see Aggregate::add_entry())
+  Entry e{re.end, t.get_a(), t.task_num, re.main_min, {}};
+  for(int i=0; i<t.get_subtl_size(); ++i)
+    e.subs.push_back({t.get_subtl(i).get_a(), t.get_subtl(i).task_num, t.get_subtl(i).duration});
+  entries.push_back(e);
+
+  for(const string& w : split_words(t.get_content())){
+    Posting& p = postings[w];
+    if(p.n && p.last == id)
+      continue;			// the same word twice in one entry
+    for(uint32_t v = id - p.last; ; v >>= 7){ // put_varint() into the string
+      if(v < 0x80){
+	p.bytes += char(v);
+	break;
+      }
+      p.bytes += char(v | 0x80);
+    }
+    p.last = id;
+    ++p.n;
+  }
+}
+
+vector<uint32_t> Content_index::decode(const Posting& p) const {
+  vector<uint32_t> ids;
+  ids.reserve(p.n);
+  istringstream iss{p.bytes};
+  uint32_t id{0};
+  for(size_t i=0; i<p.n; ++i){
+    id += get_varint(iss);
+    if(id >= entries.size())
+      throw runtime_error("Error in reading a content index: broken posting list");
+    ids.push_back(id);
+  }
+  return ids;
+}
+
+void Content_index::write(ostream& os) const {
+  os.write(index_magic, 4);
+  put_varint(os, index_version);
+  put_categories(os);
+
+  put_varint(os, entries.size());
+  time_t prev{0};
+  for(const Entry& e : entries){
+    put_svarint(os, e.end - prev);
+    prev = e.end;
+    put_varint(os, int(e.a));
+    put_varint(os, e.task_num);
+    put_svarint(os, e.main_min);
+    put_varint(os, e.subs.size());
+    for(const Aggregate::Sub_minutes& s : e.subs){
+      put_varint(os, int(s.a));
+      put_varint(os, s.task_num);
+      put_svarint(os, s.min);
+    }
+  }
+
+  put_varint(os, postings.size());
+  for(const auto& w : postings){
+    put_string(os, w.first);
+    put_varint(os, w.second.n);
+    put_string(os, w.second.bytes);
+  }
+  if(!os)
+    throw runtime_error("Error in writing a content index");
+}
+
+void Content_index::read(istream& is){
+  char magic[4];
+  if(!is.read(magic, 4) || !equal(magic, magic+4, index_magic))
+    throw runtime_error("Error in reading a content index: not a content index file");
+  uint64_t version = get_varint(is);
+  if(version != index_version)
+    throw runtime_error("Error in reading a content index: unsupported version " + to_string(version));
+  vector<int> cat_map = read_categories(is);
+  auto map_cat = [&](uint64_t i){
+    if(i == 0 || i >= cat_map.size())
+      throw runtime_error("Error in reading a content index: broken category index");
+    return activity_type(cat_map[i]);
+  };
+
+  entries.clear();
+  postings.clear();
+  uint64_t n_entry = get_varint(is);
+  time_t end{0};
+  for(uint64_t k=0; k<n_entry; ++k){
+    Entry e;
+    end += get_svarint(is);
+    e.end = end;
+    e.a = map_cat(get_varint(is));
+    e.task_num = get_varint(is);
+    e.main_min = get_svarint(is);
+    uint64_t n_sub = get_varint(is);
+    for(uint64_t j=0; j<n_sub; ++j){
+      Aggregate::Sub_minutes s;
+      s.a = map_cat(get_varint(is));
+      s.task_num = get_varint(is);
+      s.min = get_svarint(is);
+      e.subs.push_back(s);
+    }
+    entries.push_back(move(e));
+  }
+
+  uint64_t n_word = get_varint(is);
+  for(uint64_t k=0; k<n_word; ++k){
+    string w = get_string(is);
+    Posting& p = postings[w];
+    p.n = get_varint(is);
+    p.bytes = get_string(is);
+  }
+}
+
+Aggregate Content_index::query(const vector<string>& words, time_t from, time_t to) const {
+  // decode the posting lists, and intersect them from the shortest one
+  vector<vector<uint32_t>> lists;
+  for(const string& w : words){
+    auto it = postings.find(w);
+    if(it == postings.end())
+      return Aggregate{};	// a word which never appears
+    lists.push_back(decode(it->second));
+  }
+  sort(lists.begin(), lists.end(), [](const vector<uint32_t>& x, const vector<uint32_t>& y){
+    return x.size() < y.size();
+  });
+  vector<uint32_t> hits = lists.empty() ? vector<uint32_t>{} : lists[0];
+  for(size_t i=1; i<lists.size() && !hits.empty(); ++i){
+    vector<uint32_t> v;
+    set_intersection(hits.begin(), hits.end(), lists[i].begin(), lists[i].end(), back_inserter(v));
+    hits.swap(v);
+  }
+
+  Aggregate agg;
+  for(uint32_t id : hits){
+    const Entry& e = entries[id];
+    if(e.end < from || e.end >= to)
+      continue;
+    for(const Aggregate::Sub_minutes& s : e.subs)
+      agg.add(s.a, s.task_num, s.min, e.end);
+    agg.add(e.a, e.task_num, e.main_min, e.end);
+  }
+  return agg;
+}
+
+// ############################################################
+// Team cube (--cube, --rollup, count_times cube)
+// ############################################################
+
+// Minutes per person x day x activity type x task, for the timelines of a whole team.
+// Persons are interned (names -> small ids), and each person has a dense slab of days: for each day from the
+// person's first day to the last day, one row of columns (the activity types, then the tasks 0-9 of the task
+// activity). A roll-up (e.g. per person per week, or per task per month) is one pass over the slabs, and the cube
+// can be written to a compact binary file and rolled up later without reading the timeline files again.
+class Cube {
+public:
+  static const int n_task = 10;	// task digits are 0-9
+
+  int intern_person(const string& name);
+  void add_entry(int person, const Resolved_entry& re, const Where_filter* where); // an Entry_listener
+  void write(ostream& os) const;
+  void read(istream& is);
+
+  // Print the minutes grouped by dims (person, day, week, month, year, activity, task) as csv. The other dimensions
+  // are summed up. With "task", only the task activity is counted.
+  void print_rollup(ostream& os, const vector<string>& dims) const;
+
+private:
+  struct Slab {
+    long long day0{0};		// days since 1970-01-01 of the first row
+    vector<long long> v;	// [(day - day0) * n_col() + column]
+  };
+  int n_act{0};			// the activity columns of the slabs (see widen())
+  vector<string> persons;
+  map<string, int> person_ids;
+  vector<Slab> slabs;		// [person]
+
+  int n_col() const {return n_act + n_task;}
+  void add(int person, long long day, int col, long long min);
+  void widen();
+};
+
+int Cube::intern_person(const string& name){
+  auto it = person_ids.find(name);
+  if(it != person_ids.end())
+    return it->second;
+  persons.push_back(name);
+  slabs.emplace_back();
+  return person_ids[name] = persons.size()-1;
+}
+
+void Cube::add(int person, long long day, int col, long long min){
+  if(min == 0)
+    return;
+  Slab& s = slabs[person];
+  long long n_day = s.v.size() / n_col();
+  if(n_day == 0)
+    s.day0 = day;
+  if(day < s.day0){			// (rare: timelines are usually in the order of time)
+    s.v.insert(s.v.begin(), (s.day0 - day) * n_col(), 0);
+    s.day0 = day;
+  }
+  else if(day >= s.day0 + n_day)
+    s.v.resize((day - s.day0 + 1) * n_col(), 0);
+  s.v[(day - s.day0) * n_col() + col] += min;
+}
+
+// Give the slabs a column for every category of the taxonomy. The taxonomy grows when --taxonomy is read or when
+// read_categories() meets a category of a cube file that it doesn't have, so the rows of the existing slabs are laid
+// out again with the new stride: the new activity columns go between the old ones and the task columns.
+void Cube::widen(){
+  int n = taxonomy.size();
+  if(n <= n_act)
+    return;
+  int old_col = n_col(), new_col = n + n_task;
+  for(Slab& s : slabs){
+    size_t n_day = s.v.size() / old_col;
+    vector<long long> v(n_day * new_col, 0);
+    for(size_t d=0; d<n_day; ++d){
+      copy_n(s.v.begin() + d*old_col, n_act, v.begin() + d*new_col);
+      copy_n(s.v.begin() + d*old_col + n_act, n_task, v.begin() + d*new_col + n);
+    }
+    s.v = move(v);
+  }
+  n_act = n;
+}
+
+void Cube::add_entry(int person, const Resolved_entry& re, const Where_filter* where){
+  widen();
+  long long day = re.end >= 0 ? re.end/86400 : (re.end-86399)/86400;
+  Timeline& t = const_cast<Timeline&>(*re.tl); // get_subtl() is not const (see Aggregate::add_entry())
+  auto add_row = [&](activity_type a, int task_num, long long min, bool sub){
+    if(where && !(*where)({re.end, a, task_num, min, sub, &t.get_content()}))
+      return;
+    if(int(a) >= n_act || task_num < 0 || task_num >= n_task)
+      throw runtime_error("Error in adding to the cube: unknown activity type or task");
+    add(person, day, int(a), min);
+    if(a == activity_type::task)
+      add(person, day, n_act + task_num, min);
+  };
+  for(int i=0; i<t.get_subtl_size(); ++i)
+    add_row(t.get_subtl(i).get_a(), t.get_subtl(i).task_num, t.get_subtl(i).duration, true);
+  add_row(t.get_a(), t.task_num, re.main_min, false);
+}
+
+// Binary format (integers are LEB128 varints as in partial aggregates):
+//   "CTCB" (magic), version, the category table (put_categories()), number of activity columns, number of persons,
+//   then for each person: name, day0, number of days, number of nonzero cells, (cells skipped since the previous
+//   nonzero cell, minutes) per nonzero cell
+// Most cells are 0 (a day has only a few activity types), so only the nonzero ones are stored.
+const char cube_magic[4] = {'C', 'T', 'C', 'B'};
+const unsigned cube_version = 1;
+
+void Cube::write(ostream& os) const {
+  if(n_act != taxonomy.size()){	// the category table below has all the categories, so the columns must, too
+    Cube c{*this};
+    c.widen();
+    c.write(os);
+    return;
+  }
+  os.write(cube_magic, 4);
+  put_varint(os, cube_version);
+  put_categories(os);
+  put_varint(os, n_act);
+  put_varint(os, persons.size());
+  for(size_t p=0; p<persons.size(); ++p){
+    const Slab& s = slabs[p];
+    put_string(os, persons[p]);
+    put_svarint(os, s.day0);
+    put_varint(os, s.v.size() / n_col());
+    put_varint(os, count_if(s.v.begin(), s.v.end(), [](long long m){return m != 0;}));
+    size_t skip{0};
+    for(long long m : s.v){
+      if(m == 0){
+	++skip;
+	continue;
+      }
+      put_varint(os, skip);
+      put_svarint(os, m);
+      skip = 0;
+    }
+  }
+  if(!os)
+    throw runtime_error("Error in writing a cube");
+}
+
+void Cube::read(istream& is){
+  char magic[4];
+  if(!is.read(magic, 4) || !equal(magic, magic+4, cube_magic))
+    throw runtime_error("Error in reading a cube: not a cube file");
+  uint64_t version = get_varint(is);
+  if(version != cube_version)
+    throw runtime_error("Error in reading a cube: unsupported version " + to_string(version));
+  vector<int> cat_map = read_categories(is);
+  uint64_t file_n_act = get_varint(is);
+  if(file_n_act != cat_map.size())
+    throw runtime_error("Error in reading a cube: broken column table");
+  widen();			// (read_categories() may have added categories)
+  uint64_t file_n_col = file_n_act + n_task;
+
+  uint64_t n_person = get_varint(is);
+  for(uint64_t p=0; p<n_person; ++p){
+    int id = intern_person(get_string(is));
+    long long day0 = get_svarint(is);
+    uint64_t n_day = get_varint(is), n_cell = get_varint(is);
+    if(n_cell > n_day * file_n_col)
+      throw runtime_error("Error in reading a cube: broken cells");
+    uint64_t i{0};
+    for(uint64_t k=0; k<n_cell; ++k){
+      i += get_varint(is);
+      long long m = get_svarint(is);
+      if(i >= n_day * file_n_col)
+	throw runtime_error("Error in reading a cube: broken cells");
+      uint64_t col = i % file_n_col;
+      int c = col < file_n_act ? cat_map[col] : n_act + int(col - file_n_act);
+      add(id, day0 + i / file_n_col, c, m);
+      ++i;
+    }
+  }
+}
+
+void Cube::print_rollup(ostream& os, const vector<string>& dims) const {
+  bool by_task = find(dims.begin(), dims.end(), "task") != dims.end();
+  auto day_str = [](long long day, const char* fmt){
+    time_t t = day*86400;
+    char buff[16];
+    strftime(buff, sizeof(buff), fmt, gmtime(&t));
+    return string{buff};
+  };
+
+  map<vector<string>, long long> groups;
+  vector<string> key(dims.size());
+  for(size_t p=0; p<persons.size(); ++p){
+    const Slab& s = slabs[p];
+    for(size_t i=0; i<s.v.size(); ++i){
+      if(s.v[i] == 0)
+	continue;
+      long long day = s.day0 + i / n_col();
+      int col = i % n_col();
+      if(by_task != (col >= n_act)) // count either the activity columns or the task columns, not both
+	continue;
+      for(size_t k=0; k<dims.size(); ++k){
+	const string& d = dims[k];
+	if(d == "person") key[k] = persons[p];
+	else if(d == "day") key[k] = day_str(day, "%F");
+	else if(d == "week") key[k] = day_str(day - ((day + 3) % 7 + 7) % 7, "%F"); // the Monday of the week
+	else if(d == "month") key[k] = day_str(day, "%Y-%m");
+	else if(d == "year") key[k] = day_str(day, "%Y");
+	else if(d == "activity") key[k] = by_task ? convert_a2s(activity_type::task) : convert_a2s(activity_type(col));
+	else key[k] = to_string(col - n_act); // task
+      }
+      groups[key] += s.v[i];
+    }
+  }
+
+  for(const string& d : dims)
+    os << d << ',';
+  os << "minutes" << endl;
+  for(const auto& g : groups){
+    for(const string& k : g.first)
+      os << k << ',';
+    os << g.second << endl;
+  }
+}
+
+// the person of a timeline file (--person-from): "dir" (default) the name of the directory containing the file,
+// "file" the file name up to the first '-', '_' or '.', "owner" the owner of the file
+string person_of(const string& fname, const string& from){
+  size_t slash = fname.find_last_of('/');
+  string base = slash == string::npos ? fname : fname.substr(slash+1);
+  if(from == "owner"){
+    struct stat st;
+    if(stat(fname.c_str(), &st) != 0)
+      throw runtime_error("Error: cannot get the owner of " + fname + ": " + strerror(errno));
+    if(passwd* pw = getpwuid(st.st_uid))
+      return pw->pw_name;
+    return to_string(st.st_uid);
+  }
+  if(from == "dir" && slash != string::npos){
+    string dir = fname.substr(0, slash);
+    size_t s2 = dir.find_last_of('/');
+    string name = s2 == string::npos ? dir : dir.substr(s2+1);
+    if(!name.empty() && name != "." && name != "..")
+      return name;
+  }
+  // "file", or a file without a directory
+  return base.substr(0, base.find_first_of("-_."));
+}
+
+// ############################################################
+// Several reports in one run (--report)
+// ############################################################
+
+// One report requested by --report "<kind> [where <expression>] [@ <file>]", e.g.
+//   --report total  --report "daily @ daily.txt"  --report "tasks where day in Mon..Fri @ weekdays.txt"
+// kind: total (the usual report), daily (per-day totals), tasks (per-task totals) or distribution (see --distribution)
+// Every report has its own Aggregate (with its own --where filter) fed with the same resolved entries, so the files
+// are parsed once however many reports are requested.
+class Report_aggregator {
+public:
+  explicit Report_aggregator(const string& spec); // throws invalid_argument for a wrong spec
+
+  void add(const Resolved_entry& re){agg.add_entry(*re.tl, re.main_min, re.end);} // an Entry_listener
+  void print(ostream& os) const;
+  bool uses_content() const {return kind == "distribution" || (where && where->uses_content());}
+
+  string spec;
+  string out;			// the output file. Empty: stdout
+
+private:
+  string kind;
+  unique_ptr<Where_filter> where;
+  Aggregate agg;
+};
+
+Report_aggregator::Report_aggregator(const string& s)
+  : spec{s}
+{
+  string body{s};
+  size_t at = body.rfind('@');
+  if(at != string::npos){
+    istringstream iss{body.substr(at+1)};
+    if(!(iss >> out))
+      throw invalid_argument("Error: --report \"" + s + "\" needs a file name after @");
+    body.erase(at);
+  }
+  istringstream iss{body};
+  iss >> kind;
+  if(kind != "total" && kind != "daily" && kind != "tasks" && kind != "distribution")
+    throw invalid_argument("Error: unknown report \"" + kind + "\" in --report (total, daily, tasks, distribution)");
+  string w;
+  if(iss >> w){
+    if(w != "where")
+      throw invalid_argument("Error: --report \"" + s + "\": \"where\" is expected after " + kind);
+    string expr;
+    getline(iss, expr);
+    where.reset(new Where_filter{expr});
+    agg.where = where.get();
+  }
+  agg.with_sketches = kind == "distribution";
+}
+
+void Report_aggregator::print(ostream& os) const {
+  if(kind == "total")
+    print_report(os, agg);
+  else if(kind == "distribution")
+    print_distribution(os, agg, 10);
+  else if(kind == "tasks"){
+    os << "Unclassified task time: " << agg.task_min[0] << " [mins]" << endl;
+    for(size_t i=1; i<agg.task_min.size(); ++i)
+      os << "Task " << i << " time: " << agg.task_min[i] << " [mins]" << endl;
+  }
+  else{				// daily
+    for(const auto& d : agg.day_min){
+      time_t t = d.first * 86400;
+      char buff[16];
+      strftime(buff, sizeof(buff), "%F", gmtime(&t));
+      os << buff << ":";
+      for(size_t i=0; i<d.second.size(); ++i)
+	if(d.second[i])
+	  os << " " << taxonomy.categories[i].label << " " << d.second[i];
+      os << " [mins]" << endl;
+    }
+  }
+}
+
+// ############################################################
+// Edit mode (count_times edit)
+// ############################################################
+
+// A Fenwick tree (binary indexed tree) of long long: point updates and prefix sums in O(log n).
+// Elements can be appended at the end, too.
+class Fenwick {
+public:
+  size_t size() const {return t.size() - 1;}
+  void add(size_t i, long long v){ // i: 0-based
+    for(++i; i<t.size(); i += i & -i)
+      t[i] += v;
+  }
+  long long prefix(size_t n) const { // the sum of the first n elements
+    long long s{0};
+    for(; n>0; n -= n & -n)
+      s += t[n];
+    return s;
+  }
+  void push_back(long long v){
+    // the new node n covers (n - lowbit(n), n]: v and the elements before it in that range
+    size_t n = t.size();
+    t.push_back(v + prefix(n-1) - prefix(n - (n & -n)));
+  }
+private:
+  vector<long long> t = vector<long long>(1, 0); // t[0] is unused
+};
+
+// One timeline file kept in memory for an editor: when a line is replaced, only that line is parsed again.
+// The minutes of a timeline depend only on its own time stamp and the previous timeline's (set_dates() only compares
+// the two times of day), so an edit changes the contributions of the edited timeline and the one after it. Each
+// column (activity type or task) has a Fenwick tree of the contributions per timeline, so an edit updates the totals
+// in O(log n) per column, and the totals of any range of lines are two prefix sums.
+// A date line in the middle of the file is a restart point as in Ingest: it has no contribution, and neither has the
+// timeline after it (the starting point of time count). A line can be replaced with a date line or the other way.
+class Edit_session {
+public:
+  explicit Edit_session(istream& is);
+
+  // line_num is the line number in the file (1 is the date line, 2 is the first timeline).
+  // Throws runtime_error (the file is left unchanged) when the line cannot be read.
+  void replace(int line_num, const string& text);
+  void append(const string& text);
+
+  // the totals of the timelines on the lines [first, last] of the file
+  Aggregate totals(int first, int last) const;
+  int lines() const {return tls.size() + 1;}
+
+private:
+  using Contribution = vector<pair<int, long long>>; // (column, minutes). Columns: activity types, then tasks
+  vector<Timeline> tls;		 // [line - 2]. An empty Timeline for a date line
+  vector<bool> date_lines;	 // [line - 2]
+  vector<Contribution> contribs; // [line - 2]. contribs[0] is empty (the starting point of time count)
+  vector<Fenwick> cols;
+
+  int task_col(int task_num) const {return taxonomy.size() + task_num;}
+  Timeline parse(const string& text, bool& date_line) const;
+  Contribution contribution(const Timeline& prev, const Timeline& cur) const;
+  void apply(size_t j, const Contribution& c, int sign);
+};
+
+Edit_session::Edit_session(istream& is){
+  string line;
+  if(!getline(is, line))
+    throw runtime_error("Error: the timeline file is empty");
+  Aggregate dummy;
+  if(!Ingest{dummy}.read_date(line))	// check the date line as usual, although the dates are not used here
+    throw runtime_error("Error in reading the date line");
+  while(getline(is, line))
+    append(line);
+}
+
+Timeline Edit_session::parse(const string& t, bool& date_line) const {
+  Timeline tl;
+  string text{t};
+  normalize_utf8(text);
+  date_line = is_date_line(text);
+  if(date_line){
+    Aggregate dummy;
+    if(!Ingest{dummy}.read_date(text))
+      throw runtime_error("Error: the line cannot be read as a date line");
+    return tl;
+  }
+  istringstream iss{text};
+  if(!(iss >> tl))
+    throw runtime_error("Error: the line cannot be read as a timeline");
+  return tl;
+}
+
+Edit_session::Contribution Edit_session::contribution(const Timeline& prev, const Timeline& cur) const {
+  // the same calculation as Ingest::add_cur(), on a fixed date
+  tm b_tm{prev.end_t}, e_tm{cur.end_t}, ref{};
+  ref.tm_year = 100; ref.tm_mday = 1;	// 2000-01-01
+  set_dates(ref, &b_tm, &e_tm);
+  long long main_min = (timegm(&e_tm) - timegm(&b_tm)) / 60;
+
+  Contribution c;
+  Timeline& t = const_cast<Timeline&>(cur); // get_subtl() is not const (see Aggregate::add_entry())
+  for(int i=0; i<t.get_subtl_size(); ++i){
+    const Sub_Timeline& subtl = t.get_subtl(i);
+    main_min -= subtl.duration;
+    c.push_back({int(subtl.get_a()), subtl.duration});
+    if(subtl.get_a() == activity_type::task)
+      c.push_back({task_col(subtl.task_num), subtl.duration});
+  }
+  if(main_min < 0)
+    throw runtime_error("Error: the main duration became negative after subtracting sub-activities' durations");
+  c.push_back({int(cur.get_a()), main_min});
+  if(cur.get_a() == activity_type::task)
+    c.push_back({task_col(cur.task_num), main_min});
+  return c;
+}
+
+void Edit_session::apply(size_t j, const Contribution& c, int sign){
+  for(const auto& m : c){
+    while(int(cols.size()) <= m.first){
+      cols.emplace_back();
+      for(size_t k=0; k<tls.size(); ++k)
+	cols.back().push_back(0);
+    }
+    cols[m.first].add(j, sign * m.second);
+  }
+}
+
+void Edit_session::replace(int line_num, const string& text){
+  if(line_num == 1)
+    throw runtime_error("Error: the date line cannot be edited");
+  if(line_num < 1 || line_num > lines())
+    throw runtime_error("Error: no line " + to_string(line_num));
+  size_t j = line_num - 2;
+  bool date_line;
+  Timeline tl = parse(text, date_line);
+  // calculate both new contributions before changing anything, so that an error leaves the file as it was
+  Contribution cj = j && !date_line && !date_lines[j-1] ? contribution(tls[j-1], tl) : Contribution{};
+  Contribution cn = j+1 < tls.size() && !date_line && !date_lines[j+1] ? contribution(tl, tls[j+1]) : Contribution{};
+  apply(j, contribs[j], -1);
+  apply(j, cj, 1);
+  contribs[j] = cj;
+  if(j+1 < tls.size()){
+    apply(j+1, contribs[j+1], -1);
+    apply(j+1, cn, 1);
+    contribs[j+1] = cn;
+  }
+  tls[j] = move(tl);
+  date_lines[j] = date_line;
+}
+
+void Edit_session::append(const string& text){
+  bool date_line;
+  Timeline tl = parse(text, date_line);
+  Contribution c = tls.empty() || date_line || date_lines.back() ? Contribution{} : contribution(tls.back(), tl);
+  tls.push_back(move(tl));
+  date_lines.push_back(date_line);
+  for(Fenwick& f : cols)
+    f.push_back(0);
+  contribs.push_back(c);
+  apply(tls.size()-1, c, 1);
+}
+
+Aggregate Edit_session::totals(int first, int last) const {
+  size_t b = max(first, 2) - 2, e = min(last, lines()) - 1; // timelines [b, e)
+  Aggregate agg;
+  if(b >= e)
+    return agg;
+  for(int k=0; k<int(cols.size()); ++k){
+    long long v = cols[k].prefix(e) - cols[k].prefix(b);
+    if(k < taxonomy.size()){
+      if(int(agg.act_min.size()) <= k)
+	agg.act_min.resize(k+1, 0);
+      agg.act_min[k] = v;
+    }
+    else{
+      int task_num = k - taxonomy.size();
+      if(int(agg.task_min.size()) <= task_num)
+	agg.task_min.resize(task_num+1, 0);
+      agg.task_min[task_num] = v;
+    }
+  }
+  return agg;
+}
+
+// Read editing commands from is, and write the answers to os. The commands are:
+//   replace <line number> <timeline>	replace a line (with a timeline or a date line)
+//   append <timeline>			add a line at the end (a timeline or a date line)
+//   report [<first line> <last line>]	the report of the whole file or of the lines [first, last]
+//   quit
+// replace and append answer "ok" or an error message, and report is followed by an empty line.
+void run_edit_session(Edit_session& session, istream& is, ostream& os){
+  string line;
+  while(getline(is, line)){
+    istringstream iss{line};
+    string cmd;
+    iss >> cmd;
+    try{
+      if(cmd == "replace"){
+	int n;
+	if(!(iss >> n))
+	  throw runtime_error("Error: replace needs a line number");
+	iss >> ws;
+	string text;
+	getline(iss, text);
+	session.replace(n, text);
+	os << "ok" << endl;
+      }
+      else if(cmd == "append"){
+	iss >> ws;
+	string text;
+	getline(iss, text);
+	session.append(text);
+	os << "ok" << endl;
+      }
+      else if(cmd == "report"){
+	int first, last;
+	if(!(iss >> first)){
+	  first = 1;
+	  last = session.lines();
+	}
+	else if(!(iss >> last))
+	  throw runtime_error("Error: report needs both the first and last line numbers, or none");
+	print_report(os, session.totals(first, last));
+	os << endl;
+      }
+      else if(cmd == "quit")
+	return;
+      else if(!cmd.empty())
+	throw runtime_error("Error: unknown command " + cmd);
+    }
+    catch(runtime_error& e){
+      os << e.what() << endl;
+    }
+  }
+}
+
+// ############################################################
+// Live totals in shared memory (count_times publish, count_times status)
+// ############################################################
+
+// The layout of the shared memory segment written by count_times publish. A status bar or a dashboard maps it
+// (shm_open(), mmap()) and reads a consistent snapshot without running the parser, with the seqlock protocol of
+// read_live_totals(): the writer makes seq odd before changing the fields and even again after, so a reader retries
+// while seq is odd or when it changed during the copy. The writer never waits for readers, and readers only read.
+// All times are the local wall-clock times counted as seconds since 1970-01-01 (like the time stamps of timelines).
+struct Live_segment {
+  static const uint32_t magic_v = 0x41544c43; // "CLTA" (little endian: 'C','L','T','A')
+  static const int max_act = 64;
+  static const int max_task = 10;		// task digits 0-9
+  static const int label_len = 32;
+
+  atomic<uint32_t> seq;
+  atomic<uint32_t> magic;	// set after labels, when the segment is ready
+  char labels[max_act][label_len]; // the names of the activity types (written once before magic)
+  atomic<int32_t> n_act;
+  atomic<int64_t> updated;	// when the fields were written
+  atomic<int64_t> running_from;	// the time stamp of the last timeline: the current activity is going on since then
+  atomic<int64_t> today;	// days since 1970-01-01 of today_min
+  atomic<int64_t> act_min[max_act];   // total minutes per activity type
+  atomic<int64_t> task_min[max_task]; // total minutes per task
+  atomic<int64_t> today_min[max_act]; // today's minutes per activity type
+};
+static_assert(atomic<int64_t>::is_always_lock_free && atomic<uint32_t>::is_always_lock_free,
+	      "the live segment needs lock-free atomics to be shared between processes");
+
+// a copy of the segment
+struct Live_totals {
+  long long updated, running_from, today;
+  vector<string> labels;
+  vector<long long> act_min, task_min, today_min;
+};
+
+// "name" -> "/name" (shm_open() needs the leading '/')
+string shm_name(const string& name){
+  return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// the local wall-clock time now, in the same seconds as the time stamps
+time_t wall_clock_now(){
+  time_t now = time(nullptr);
+  tm lt;
+  localtime_r(&now, &lt);
+  return timegm(&lt);
+}
+
+// Creates the segment (replacing an old one of the same name) and removes it in the destructor.
+// Errors are thrown as runtime_error.
+class Live_publisher {
+public:
+  explicit Live_publisher(const string& name);
+  ~Live_publisher();
+  Live_publisher(const Live_publisher&) = delete;
+  Live_publisher& operator=(const Live_publisher&) = delete;
+
+  void publish(const Aggregate& agg, time_t now);
+
+private:
+  string name;
+  Live_segment* seg;
+};
+
+Live_publisher::Live_publisher(const string& n)
+  : name{shm_name(n)}
+{
+  if(taxonomy.size() > Live_segment::max_act)
+    throw runtime_error("Error: the live segment holds up to " + to_string(Live_segment::max_act) + " activity types");
+  shm_unlink(name.c_str());	// a segment left by a killed publisher
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(fd < 0)
+    throw runtime_error("Error in creating shared memory " + name + ": " + strerror(errno));
+  if(ftruncate(fd, sizeof(Live_segment)) != 0){
+    int e = errno;
+    close(fd);
+    shm_unlink(name.c_str());
+    throw runtime_error("Error in creating shared memory " + name + ": " + strerror(e));
+  }
+  void* p = mmap(nullptr, sizeof(Live_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED){
+    int e = errno;
+    shm_unlink(name.c_str());
+    throw runtime_error("Error in mapping shared memory " + name + ": " + strerror(e));
+  }
+  seg = static_cast<Live_segment*>(p); // ftruncate() filled it with 0 (atomics of 0 are valid, as they're lock-free)
+  for(int i=0; i<taxonomy.size(); ++i)
+    strncpy(seg->labels[i], taxonomy.categories[i].label.c_str(), Live_segment::label_len-1);
+  seg->n_act.store(taxonomy.size(), memory_order_relaxed);
+  seg->magic.store(Live_segment::magic_v, memory_order_release);
+}
+
+Live_publisher::~Live_publisher(){
+  munmap(seg, sizeof(Live_segment));
+  shm_unlink(name.c_str());
+}
+
+void Live_publisher::publish(const Aggregate& agg, time_t now){
+  long long today = now / 86400;
+  auto d = agg.day_min.find(today);
+  uint32_t s = seg->seq.load(memory_order_relaxed);
+  seg->seq.store(s+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release); // the odd seq is seen before any of the new fields
+  seg->updated.store(now, memory_order_relaxed);
+  seg->running_from.store(agg.has_entries ? agg.last_t : 0, memory_order_relaxed);
+  seg->today.store(today, memory_order_relaxed);
+  for(int i=0; i<taxonomy.size(); ++i){
+    seg->act_min[i].store(agg.act_min[i], memory_order_relaxed);
+    seg->today_min[i].store(d != agg.day_min.end() && size_t(i) < d->second.size() ? d->second[i] : 0, memory_order_relaxed);
+  }
+  for(int i=0; i<Live_segment::max_task; ++i)
+    seg->task_min[i].store(size_t(i) < agg.task_min.size() ? agg.task_min[i] : 0, memory_order_relaxed);
+  seg->seq.store(s+2, memory_order_release);
+}
+
+// Read a consistent snapshot of the segment. Errors are thrown as runtime_error.
+Live_totals read_live_totals(const string& n){
+  string name = shm_name(n);
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if(fd < 0)
+    throw runtime_error("Error: shared memory " + name + " is not found (is count_times publish running?)");
+  struct stat st;
+  if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Live_segment)){
+    close(fd);
+    throw runtime_error("Error: shared memory " + name + " is not a live segment of count_times");
+  }
+  void* p = mmap(nullptr, sizeof(Live_segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED)
+    throw runtime_error("Error in mapping shared memory " + name + ": " + strerror(errno));
+  const Live_segment* seg = static_cast<const Live_segment*>(p);
+  if(seg->magic.load(memory_order_acquire) != Live_segment::magic_v){
+    munmap(p, sizeof(Live_segment));
+    throw runtime_error("Error: shared memory " + name + " is not a live segment of count_times");
+  }
+
+  Live_totals t;
+  int n_act = min<int>(seg->n_act.load(memory_order_relaxed), Live_segment::max_act);
+  for(int i=0; i<n_act; ++i)
+    t.labels.emplace_back(seg->labels[i], strnlen(seg->labels[i], Live_segment::label_len));
+  t.act_min.resize(n_act);
+  t.today_min.resize(n_act);
+  t.task_min.resize(Live_segment::max_task);
+  uint32_t s1, s2;
+  do{
+    while((s1 = seg->seq.load(memory_order_acquire)) & 1)
+      this_thread::yield();	// the publisher is writing
+    t.updated = seg->updated.load(memory_order_relaxed);
+    t.running_from = seg->running_from.load(memory_order_relaxed);
+    t.today = seg->today.load(memory_order_relaxed);
+    for(int i=0; i<n_act; ++i){
+      t.act_min[i] = seg->act_min[i].load(memory_order_relaxed);
+      t.today_min[i] = seg->today_min[i].load(memory_order_relaxed);
+    }
+    for(int i=0; i<Live_segment::max_task; ++i)
+      t.task_min[i] = seg->task_min[i].load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire); // the fields are read before seq is checked again
+    s2 = seg->seq.load(memory_order_relaxed);
+  }while(s1 != s2);
+  munmap(p, sizeof(Live_segment));
+  return t;
+}
+
+volatile sig_atomic_t stop_publishing = 0;
+extern "C" void on_stop_signal(int){stop_publishing = 1;}
+
+// count_times publish: count the timeline files, publish the totals, and count them again whenever one of them is
+// modified (checked every poll_sec seconds) until SIGINT/SIGTERM. The totals are published at every check, too, to
+// keep "today" right after midnight. When a file has an error, the previous totals are kept until it's fixed.
+void run_publisher(const string& name, const vector<string>& fnames, int poll_sec){
+  Live_publisher pub{name};
+  signal(SIGINT, on_stop_signal);
+  signal(SIGTERM, on_stop_signal);
+  Aggregate total;
+  vector<pair<time_t, long>> mtimes(fnames.size(), {-1, -1}); // (st_mtim.tv_sec, tv_nsec) of each file
+  while(!stop_publishing){
+    bool changed{false};
+    for(size_t k=0; k<fnames.size(); ++k){
+      struct stat st;
+      pair<time_t, long> m{-1, -1};
+      if(stat(fnames[k].c_str(), &st) == 0)
+	m = {st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+      if(m != mtimes[k]){
+	mtimes[k] = m;
+	changed = true;
+      }
+    }
+    if(changed){
+      Aggregate t;
+      bool ok{true};
+      for(const string& fname : fnames){
+	Aggregate agg;
+	try{
+	  unique_ptr<istream> in = open_input(fname);
+	  ok = read_timeline_file(*in, agg);
+	}
+	catch(exception& e){
+	  cerr << e.what() << endl;
+	  ok = false;
+	}
+	if(!ok)
+	  break;
+	t.merge(agg);
+      }
+      if(ok)
+	total = move(t);
+    }
+    pub.publish(total, wall_clock_now());
+    for(int i=0; i<poll_sec*10 && !stop_publishing; ++i)
+      this_thread::sleep_for(chrono::milliseconds(100));
+  }
+}
+
+// count_times status: print the published totals in short lines for a status bar
+void print_live_totals(ostream& os, const Live_totals& t, time_t now){
+  if(t.running_from){
+    time_t r = t.running_from;
+    os << "Running: " << (now - r)/60 << " [mins] since " << put_time(gmtime(&r), "%F %R") << endl;
+  }
+  auto print_mins = [&os, &t](const char* title, const vector<long long>& v){
+    os << title << ":";
+    const char* sep = " ";
+    for(size_t i=0; i<v.size(); ++i)
+      if(v[i]){
+	os << sep << t.labels[i] << " " << v[i];
+	sep = ", ";
+      }
+    os << " [mins]" << endl;
+  };
+  print_mins("Today", now/86400 == t.today ? t.today_min : vector<long long>{});
+  print_mins("Total", t.act_min);
+  os << "Tasks:";
+  const char* sep = " ";
+  for(size_t i=0; i<t.task_min.size(); ++i)
+    if(t.task_min[i]){
+      os << sep << i << " " << t.task_min[i];
+      sep = ", ";
+    }
+  os << " [mins]" << endl;
+}
+
+// ############################################################
+// Library interface (namespace count_times)
+// ############################################################
+
+// Our own tools can use the parser by including this file with COUNT_TIMES_NO_MAIN defined (then main() is not
+// compiled) and reading the resolved entries with a range-for:
+//
+//   #define COUNT_TIMES_NO_MAIN
+//   #include "count_times.cpp"
+//   ...
+//   for(const Resolved_entry& e : count_times::entries("2025-01.txt")
+//				    | count_times::filter([](const Resolved_entry& e){return e.main_min >= 60;})
+//				    | count_times::take(10))
+//     cout << e.tl->get_content() << endl;
+//
+// The entries are parsed lazily, one line per increment, from a reused line buffer, so nothing is collected in a
+// container, and leaving the loop early stops reading the file (the file is closed when the range is destroyed).
+// (This is a plain C++17 input range rather than a C++20 coroutine generator, as this program is compiled with
+// -std=c++17.)
+namespace count_times {
+
+class Entry_range {
+  struct State {
+    State(const string& path) : fname{path}, in{open_input(path)}, ingest{agg} {}
+    string fname;
+    unique_ptr<istream> in;
+    Aggregate agg;		// Ingest needs it, although only the entries are used here
+    Ingest ingest;
+    string line;		// reused for every line
+    tm file_date;		// the global "date" of this file (see next())
+    Resolved_entry current;
+    bool done{false};
+  };
+
+public:
+  explicit Entry_range(const string& path);
+
+  // an input iterator. The entry it points to is valid until the next increment.
+  class iterator {
+  public:
+    using iterator_category = input_iterator_tag;
+    using value_type = Resolved_entry;
+    using difference_type = ptrdiff_t;
+    using pointer = const Resolved_entry*;
+    using reference = const Resolved_entry&;
+
+    iterator(State* s = nullptr) : st{s} {}
+    reference operator*() const {return st->current;}
+    pointer operator->() const {return &st->current;}
+    iterator& operator++(){
+      if(!Entry_range::next(*st))
+	st = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator& o) const {return st == o.st;}
+    bool operator!=(const iterator& o) const {return st != o.st;}
+  private:
+    State* st;			// nullptr: the end
+  };
+
+  iterator begin(){return st->done || !next(*st) ? end() : iterator{st.get()};}
+  iterator end(){return iterator{};}
+
+private:
+  unique_ptr<State> st;	// (kept behind a pointer so that a range can be moved into filter/take)
+
+  static bool next(State& s);	// read up to the next entry. false at the end of the file
+};
+
+Entry_range::Entry_range(const string& path)
+  : st{new State{path}}
+{
+  State& s = *st;
+  s.ingest.listeners.push_back([&s](const Resolved_entry& re){s.current = re;});
+  // (copy-assigning reuses the capacity of current.sub_intervals)
+  if(!getline(*s.in, s.line) || !s.ingest.read_date(s.line))
+    throw runtime_error("Error in reading the date line of " + path);
+  s.file_date = date;
+}
+
+bool Entry_range::next(State& s){
+  // The global "date" is the date of the timeline being read. Several ranges can be read alternately in one thread,
+  // so each range keeps its own date and puts it in "date" while reading.
+  tm saved = date;
+  date = s.file_date;
+  bool found{false};
+  while(!found && getline(*s.in, s.line)){
+    int c = s.ingest.c;
+    if(!s.ingest.feed(s.line)){
+      date = saved;
+      throw runtime_error("Error in reading " + s.fname);
+    }
+    found = c > s.ingest.first_c; // the first timeline (after a date line) is only the starting point (no entry)
+  }
+  s.file_date = date;
+  date = saved;
+  if(found)
+    s.current.tl = &s.ingest.prev; // Ingest::add_cur() swaps the entry's Timeline into prev after the listeners
+  else
+    s.done = true;
+  return found;
+}
+
+inline Entry_range entries(const string& path){return Entry_range{path};}
+
+// range adaptors. "range | filter(pred)" and "range | take(n)" work on Entry_range and on the adaptors themselves.
+template<class Pred> struct Filter {Pred pred;};
+template<class Pred> Filter<Pred> filter(Pred p){return {move(p)};}
+struct Take {size_t n;};
+inline Take take(size_t n){return {n};}
+
+template<class R, class Pred>
+class Filter_view {
+public:
+  Filter_view(R r, Pred p) : range{move(r)}, pred{move(p)} {}
+
+  class iterator {
+  public:
+    using base = decltype(declval<R&>().begin());
+    using iterator_category = input_iterator_tag;
+    using value_type = typename iterator_traits<base>::value_type;
+    using difference_type = ptrdiff_t;
+    using pointer = typename iterator_traits<base>::pointer;
+    using reference = typename iterator_traits<base>::reference;
+
+    iterator(base i, base e, const Pred* p) : it{i}, last{e}, pred{p} {skip();}
+    reference operator*() const {return *it;}
+    pointer operator->() const {return &*it;}
+    iterator& operator++(){++it; skip(); return *this;}
+    bool operator==(const iterator& o) const {return it == o.it;}
+    bool operator!=(const iterator& o) const {return it != o.it;}
+  private:
+    base it, last;
+    const Pred* pred;
+    void skip(){while(it != last && !(*pred)(*it)) ++it;}
+  };
+
+  iterator begin(){auto e = range.end(); return {range.begin(), e, &pred};}
+  iterator end(){auto e = range.end(); return {e, e, &pred};}
+
+private:
+  R range;
+  Pred pred;
+};
+
+template<class R>
+class Take_view {
+public:
+  Take_view(R r, size_t n) : range{move(r)}, n{n} {}
+
+  class iterator {
+  public:
+    using base = decltype(declval<R&>().begin());
+    using iterator_category = input_iterator_tag;
+    using value_type = typename iterator_traits<base>::value_type;
+    using difference_type = ptrdiff_t;
+    using pointer = typename iterator_traits<base>::pointer;
+    using reference = typename iterator_traits<base>::reference;
+
+    iterator(base i, base e, size_t left) : it{i}, last{e}, left{left} {if(left == 0) it = last;}
+    reference operator*() const {return *it;}
+    pointer operator->() const {return &*it;}
+    iterator& operator++(){
+      // stop without reading any further, once n entries are taken
+      if(--left == 0)
+	it = last;
+      else
+	++it;
+      return *this;
+    }
+    bool operator==(const iterator& o) const {return it == o.it;}
+    bool operator!=(const iterator& o) const {return it != o.it;}
+  private:
+    base it, last;
+    size_t left;
+  };
+
+  iterator begin(){auto e = range.end(); return {n ? range.begin() : e, e, n};}
+  iterator end(){auto e = range.end(); return {e, e, 0};}
+
+private:
+  R range;
+  size_t n;
+};
+
+template<class R, class Pred>
+Filter_view<decay_t<R>, Pred> operator|(R&& r, Filter<Pred> f){return {forward<R>(r), move(f.pred)};}
+
+template<class R>
+Take_view<decay_t<R>> operator|(R&& r, Take t){return {forward<R>(r), t.n};}
+
+// ------------------------------------------------------------
+// Live logging from apps
+// ------------------------------------------------------------
+
+// Our apps (timer widgets, IDE plugins) can record timelines directly, instead of appending "- t3 14:00 ..." to a
+// file and running the parser again:
+//
+//   count_times::Live_log log{"2025-10.txt"};	// the lines are also appended to this file ("": no file)
+//   log.record(time(nullptr), "t3", "did task 3 (w ~10m)"); // from any thread
+//   ...
+//   auto snap = log.snapshot();	// from any thread, while timelines are still recorded
+//   print_report(cout, *snap);
+//
+// record() takes the activity list and the content of a timeline line, and the time stamp (the end of the activity,
+// as in a file). The line is parsed on the calling thread, so a wrong line throws there, and pushed to a lock-free
+// Mpsc_queue. One aggregator thread takes the timelines in batches, sorts each batch by time (timelines recorded at
+// about the same time by different threads can be out of order), and adds them with Ingest, the same accounting as
+// main(): the interval from the previous time stamp minus the sub-activities, per activity type and task.
+// The lines of a batch are appended to the text file with one write(), so that count_times on the file gives the same
+// totals:
+//  - the file gets a date line before the first timeline, and again when more than 23 hours pass between two
+//    timelines (set_dates() can only move to the next day). As with a date line in a file, the timeline after it is
+//    only the starting point.
+//  - the time stamps are counted in minutes, as they are written.
+//  - a timeline older than one already added (its producer was late by more than a batch) can't be written in order,
+//    and one with sub-activities longer than its interval would make count_times stop at the file, so they are
+//    dropped (the number is in dropped()).
+// Reports and queries read the totals from snapshots (Snapshot_store): after each batch, the aggregator thread
+// publishes a copy of its Aggregate, and readers pin the latest copy without any lock. So a reader sees the totals of
+// whole batches only, and any number of readers don't slow down the aggregator (it copies the totals once per batch,
+// however many readers there are, and never waits for them).
+class Live_log {
+public:
+  explicit Live_log(const string& text_file = "", const vector<Entry_listener>& listeners = {});
+  ~Live_log();			// adds the remaining timelines and stops the aggregator thread
+  Live_log(const Live_log&) = delete;
+  Live_log& operator=(const Live_log&) = delete;
+
+  // end: the time stamp (the local wall clock of it is used, like the times written in timeline files).
+  // activities: e.g. "t3" or "H+w". content: the rest of the line, e.g. "did task 3 (w ~10m)". It can't be empty.
+  void record(time_t end, const string& activities, const string& content);
+  void flush();			// wait until the timelines recorded so far are in the snapshot (and written)
+  Snapshot_store<Aggregate>::Snapshot snapshot() const {return snapshots.read();} // the latest totals
+  Aggregate totals() const {return *snapshot();}				  // a copy of them
+  size_t dropped() const {return n_dropped.load();}
+
+private:
+  struct Event {
+    time_t t{0};		// end_t of tl as time_t (the wall clock treated as UTC, see set_dates())
+    Timeline tl;
+    string line;		// e.g. "- t3 14:00 did task 3 (w ~10m)"
+  };
+
+  void run();			// the aggregator thread
+  void add(Event& ev);
+  bool publish();		// publish agg as a snapshot. false: try again later
+
+  Mpsc_queue<Event> queue;
+  atomic<size_t> n_recorded{0};
+  atomic<size_t> n_dropped{0};
+  atomic<bool> stopping{false};
+
+  // The aggregator thread sleeps on wake when the queue is empty. The producers take wake_m only when it sleeps
+  // (idle is true), so record() doesn't wait for anything while the aggregator is busy.
+  atomic<bool> idle{false};
+  mutex wake_m;
+  condition_variable wake;
+
+  // The state of the aggregator thread (only it uses them)
+  Aggregate agg;
+  Ingest ingest;
+  size_t n_added{0};		// the number of timelines added or dropped
+  time_t last_t{0};
+  unique_ptr<Buffered_writer> out;
+
+  // the published copies of agg. The version of a snapshot is n_added at the time of the copy
+  Snapshot_store<Aggregate> snapshots;
+  // flush() waits on done for n_published (the version of the latest snapshot) or an error
+  mutex done_m;
+  condition_variable done;
+  size_t n_published{0};
+  exception_ptr error;		// an error in writing the text file (rethrown by flush())
+
+  thread aggregator;		// (the last member, started after the others are constructed)
+};
+
+Live_log::Live_log(const string& text_file, const vector<Entry_listener>& listeners)
+  : ingest{agg, listeners}, out{text_file.empty() ? nullptr : new Buffered_writer{text_file, true}},
+    aggregator{&Live_log::run, this}
+{
+}
+
+Live_log::~Live_log(){
+  stopping.store(true);
+  {
+    lock_guard<mutex> l{wake_m};
+    wake.notify_one();
+  }
+  aggregator.join();
+}
+
+void Live_log::record(time_t end, const string& activities, const string& content){
+  if(activities.find('\n') != string::npos || content.find('\n') != string::npos)
+    throw invalid_argument("Error: a timeline must be one line");
+  tm local;
+  localtime_r(&end, &local);
+  local.tm_sec = 0;
+  local.tm_isdst = 0;
+
+  Event ev;
+  ev.line = "- " + activities + " " + to_string(local.tm_hour) + (local.tm_min < 10 ? ":0" : ":")
+    + to_string(local.tm_min) + " " + content;
+  normalize_utf8(ev.line);
+  // the sub-activity time stamps in the content, e.g. (s 12:20 - 12:30), are read on the date of end
+  tm saved = date;
+  date = local;
+  date.tm_hour = date.tm_min = 0;
+  istringstream iss{ev.line};
+  bool ok = bool(iss >> ev.tl);
+  date = saved;
+  if(!ok)
+    throw invalid_argument("Error: cannot read the timeline \"" + ev.line + "\"");
+  ev.tl.end_t = local;
+  ev.t = timegm(&ev.tl.end_t);
+
+  n_recorded.fetch_add(1);
+  queue.push(move(ev));
+  atomic_thread_fence(memory_order_seq_cst); // (pairs with the one in run(): either we see idle, or it sees ev)
+  if(idle.load()){
+    lock_guard<mutex> l{wake_m};
+    wake.notify_one();
+  }
+}
+
+void Live_log::flush(){
+  size_t n = n_recorded.load();
+  unique_lock<mutex> l{done_m};
+  done.wait(l, [this, n](){return n_published >= n || error;});
+  if(error)
+    rethrow_exception(error);
+}
+
+void Live_log::run(){
+  vector<Event> batch;
+  bool stale{false};		// agg has timelines not published yet (all the other slots were pinned)
+  for(;;){
+    Event ev;
+    while(queue.try_pop(ev))
+      batch.push_back(move(ev));
+    if(batch.empty()){
+      if(stale)
+	stale = !publish();
+      if(stopping.load())
+	break;
+      unique_lock<mutex> l{wake_m};
+      idle.store(true);
+      atomic_thread_fence(memory_order_seq_cst);
+      if(queue.empty() && !stopping.load())
+	wake.wait_for(l, chrono::milliseconds(stale ? 1 : 100)); // (the timeout is only a safety net, or for publish())
+      idle.store(false);
+      continue;
+    }
+
+    stable_sort(batch.begin(), batch.end(), [](const Event& x, const Event& y){return x.t < y.t;});
+    for(Event& e : batch)
+      add(e);
+    n_added += batch.size();
+    batch.clear();
+    if(out && !error){
+      try{
+	out->flush();		// one write() per batch
+      }
+      catch(...){
+	lock_guard<mutex> l{done_m};
+	error = current_exception();
+	done.notify_all();
+      }
+    }
+    stale = !publish();
+  }
+}
+
+bool Live_log::publish(){
+  if(!snapshots.publish(agg, n_added))
+    return false;
+  lock_guard<mutex> l{done_m};
+  n_published = n_added;
+  done.notify_all();
+  return true;
+}
+
+void Live_log::add(Event& e){
+  bool first = ingest.c == 1;
+  if(!first && e.t < last_t){
+    ++n_dropped;
+    return;
+  }
+  bool restart = first || e.t - last_t > 23*60*60;
+  if(restart)
+    ingest.first_c = ingest.c;	// the starting point, as after a date line
+  try{
+    ingest.add_dated(move(e.tl));
+  }
+  catch(runtime_error& err){	// the sub-activities are longer than the interval
+    cerr << err.what() << " (the timeline is dropped)" << endl;
+    ++n_dropped;
+    return;
+  }
+  last_t = e.t;
+  if(out){
+    if(restart){
+      tm d;
+      gmtime_r(&e.t, &d);
+      out->put(to_string(d.tm_mon+1) + "/" + to_string(d.tm_mday) + "/" + to_string(d.tm_year+1900) + "\n");
+    }
+    out->put(e.line);
+    out->put('\n');
+  }
+}
+
+} // namespace count_times
+
+// ############################################################
+// Command line options
+// ############################################################
+
+// Usage:
+//   count_times [options] <timeline text file>...
+//   count_times merge [options] <partial aggregate file>...
+//   count_times query [--from yyyy-mm-dd] [--to yyyy-mm-dd] <content index file> <word>...
+//   count_times edit <timeline text file>	(editing commands from stdin. See run_edit_session())
+//   count_times cube [--rollup dims] <cube file>...
+//   count_times publish [--poll SECS] <segment name> <timeline text file>...
+//   count_times status <segment name>
+struct Options {
+  bool merge_mode{false};	// "merge" subcommand
+  bool query_mode{false};	// "query" subcommand
+  bool edit_mode{false};	// "edit" subcommand
+  bool cube_mode{false};	// "cube" subcommand
+  bool publish_mode{false};	// "publish" subcommand
+  bool status_mode{false};	// "status" subcommand
+  int poll{2};			// publish: --poll SECS, how often the timeline files are checked
+  string cube;			// --cube: write the person x day x activity x task cube to this file
+  vector<vector<string>> rollups; // --rollup person,week,...: show the cube rolled up to these dimensions
+  string person_from{"dir"};	// --person-from dir|file|owner: how to get the person of a timeline file
+  string export_intervals;	// --export-intervals: write the resolved intervals to this file ("-": stdout)
+  string export_format;		// --export-format csv|ndjson|binary (by default, from the file extension)
+  vector<string> reports;	// --report "<kind> [where <expression>] [@ <file>]" (see Report_aggregator)
+  string build_index;		// --build-index: write the content index of the timeline files to this file
+  time_t from{numeric_limits<time_t>::min()}, to{numeric_limits<time_t>::max()};
+  // query and timeline files: --from/--to dates (the entries ending in [from, to) are counted. to is exclusive)
+  bool build_date_index{false};	// --build-date-index: write the date index of each timeline file (see Date_index)
+  bool stitch{false};		// merge: stitch adjacent partials (--stitch)
+  string emit_partial;		// write the aggregate to this file instead of printing the report
+  bool pipeline{false};		// --pipeline: read, parse and aggregate in different threads
+  string journal;		// --journal: record the finished files in this file, and skip the ones recorded
+  int checkpoint{8};		// --checkpoint N: fsync() the journal every N files
+  bool main_only{false};	// --main-only: ignore sub-activities (their time is counted as the main activity's)
+  bool merge_devices{false};	// --merge-devices: count the input files as one timeline merged by time
+  bool dedup{false};		// --dedup: skip the timelines already read from another file (or the same file)
+  int dedup_window{0};		// --dedup-window DAYS: remember the timelines of only the last DAYS days (0: all)
+  int parsers{0};		// --parsers N: the number of parser threads in the pipeline mode (0: automatic)
+  bool stats{false};		// --stats: show the time spent in each pipeline stage
+  vector<time_t> at;		// --at "yyyy-mm-dd hh:mm": show what was done at these times
+  bool overlaps{false};		// --overlaps: show sub-activities outside their main activity or overlapping each other
+  string where;			// --where: count only the rows matching this expression (see Where_filter)
+  bool distribution{false};	// --distribution: show session-length percentiles, the longest blocks and top phrases
+  size_t top{10};		// --top N: the number of longest blocks and phrases shown by --distribution
+  bool heatmap{false};		// --heatmap: show the minutes per time of day and per weekday and hour
+  int bucket{60};		// --bucket N: the bucket size [mins] of the time-of-day table of --heatmap
+  vector<string> inputs;
+};
+
+Options parse_options(int argc, char** argv){
+  Options opt;
+  int i{1};
+  if(argc > 1 && string(argv[1]) == "merge"){
+    opt.merge_mode = true;
+    ++i;
+  }
+  else if(argc > 1 && string(argv[1]) == "query"){
+    opt.query_mode = true;
+    ++i;
+  }
+  else if(argc > 1 && string(argv[1]) == "edit"){
+    opt.edit_mode = true;
+    ++i;
+  }
+  else if(argc > 1 && string(argv[1]) == "cube"){
+    opt.cube_mode = true;
+    ++i;
+  }
+  else if(argc > 1 && string(argv[1]) == "publish"){
+    opt.publish_mode = true;
+    ++i;
+  }
+  else if(argc > 1 && string(argv[1]) == "status"){
+    opt.status_mode = true;
+    ++i;
+  }
+  auto next_arg = [&](const string& arg){
+    if(++i == argc)
+      throw invalid_argument("Error: " + arg + " needs an argument");
+    return string(argv[i]);
+  };
+  auto read_day = [](const string& arg, const string& s){
+    istringstream iss{s};
+    tm t{};
+    iss >> get_time(&t, "%Y-%m-%d");
+    if(iss.fail())
+      throw invalid_argument("Error: " + arg + " needs a date in the form of yyyy-mm-dd, e.g. 2025-03-04");
+    return timegm(&t);
+  };
+  for(; i<argc; ++i){
+    string arg{argv[i]};
+    if(arg == "--taxonomy"){
+      string tname = next_arg(arg);
+      ifstream tfs{tname};
+      if(!tfs)
+	throw invalid_argument("Error: cannot open taxonomy file " + tname);
+      taxonomy.load(tfs);
+    }
+    else if(arg == "--emit-partial")
+      opt.emit_partial = next_arg(arg);
+    else if(arg == "--stitch" && opt.merge_mode)
+      opt.stitch = true;
+    else if(arg == "--pipeline")
+      opt.pipeline = true;
+    else if(arg == "--merge-devices")
+      opt.merge_devices = true;
+    else if(arg == "--main-only")
+      opt.main_only = true;
+    else if(arg == "--journal")
+      opt.journal = next_arg(arg);
+    else if(arg == "--checkpoint"){
+      opt.checkpoint = stoi(next_arg(arg));
+      if(opt.checkpoint < 1)
+	throw invalid_argument("Error: --checkpoint needs a positive number of files");
+    }
+    else if(arg == "--dedup")
+      opt.dedup = true;
+    else if(arg == "--dedup-window"){
+      opt.dedup = true;
+      opt.dedup_window = stoi(next_arg(arg));
+      if(opt.dedup_window < 1)
+	throw invalid_argument("Error: --dedup-window needs a positive number of days");
+    }
+    else if(arg == "--parsers"){
+      opt.parsers = stoi(next_arg(arg));
+      if(opt.parsers < 1)
+	throw invalid_argument("Error: --parsers needs a positive number");
+    }
+    else if(arg == "--stats")
+      opt.stats = true;
+    else if(arg == "--at"){
+      string s = next_arg(arg);
+      istringstream iss{s};
+      tm t{};
+      iss >> get_time(&t, "%Y-%m-%d %H:%M");
+      if(iss.fail())
+	throw invalid_argument("Error: --at needs a time in the form of \"yyyy-mm-dd hh:mm\", e.g. \"2025-03-04 15:10\"");
+      opt.at.push_back(timegm(&t));
+    }
+    else if(arg == "--overlaps")
+      opt.overlaps = true;
+    else if(arg == "--build-index")
+      opt.build_index = next_arg(arg);
+    else if(arg == "--from")
+      opt.from = read_day(arg, next_arg(arg));
+    else if(arg == "--to")
+      opt.to = read_day(arg, next_arg(arg));
+    else if(arg == "--build-date-index")
+      opt.build_date_index = true;
+    else if(arg == "--cube")
+      opt.cube = next_arg(arg);
+    else if(arg == "--rollup"){
+      vector<string> dims;
+      istringstream iss{next_arg(arg)};
+      string d;
+      while(getline(iss, d, ',')){
+	static const vector<string> names{"person", "day", "week", "month", "year", "activity", "task"};
+	if(find(names.begin(), names.end(), d) == names.end())
+	  throw invalid_argument("Error: unknown dimension " + d + " in --rollup (person, day, week, month, year, activity, task)");
+	dims.push_back(d);
+      }
+      if(dims.empty())
+	throw invalid_argument("Error: --rollup needs dimensions, e.g. person,week");
+      opt.rollups.push_back(dims);
+    }
+    else if(arg == "--person-from"){
+      opt.person_from = next_arg(arg);
+      if(opt.person_from != "dir" && opt.person_from != "file" && opt.person_from != "owner")
+	throw invalid_argument("Error: --person-from takes dir, file or owner");
+    }
+    else if(arg == "--poll" && opt.publish_mode){
+      opt.poll = stoi(next_arg(arg));
+      if(opt.poll < 1)
+	throw invalid_argument("Error: --poll needs a positive number of seconds");
+    }
+    else if(arg == "--export-intervals")
+      opt.export_intervals = next_arg(arg);
+    else if(arg == "--export-format")
+      opt.export_format = next_arg(arg);
+    else if(arg == "--report")
+      opt.reports.push_back(next_arg(arg));
+    else if(arg == "--heatmap")
+      opt.heatmap = true;
+    else if(arg == "--bucket"){
+      opt.bucket = stoi(next_arg(arg));
+      if(opt.bucket < 1 || opt.bucket > 1440)
+	throw invalid_argument("Error: --bucket needs a number of minutes from 1 to 1440");
+    }
+    else if(arg == "--where")
+      opt.where = next_arg(arg);
+    else if(arg == "--distribution")
+      opt.distribution = true;
+    else if(arg == "--top"){
+      int n = stoi(next_arg(arg));
+      if(n < 1 || size_t(n) > Sketches::n_longest)
+	throw invalid_argument("Error: --top needs a number from 1 to " + to_string(Sketches::n_longest));
+      opt.top = n;
+    }
+    else if(arg.size() > 1 && arg[0] == '-' && arg[1] == '-')
+      throw invalid_argument("Error: unknown option " + arg);
+    else
+      opt.inputs.push_back(arg);
+  }
+  if(opt.inputs.empty()){
+    if(opt.merge_mode)
+      throw invalid_argument("Error: you need to specify the partial aggregate files to merge");
+    if(opt.query_mode)
+      throw invalid_argument("Error: you need to specify the content index file and the words to search for");
+    if(opt.publish_mode || opt.status_mode)
+      throw invalid_argument("Error: you need to specify the name of the shared memory segment");
+    throw invalid_argument("Error: you need to specify the text file name with timelines");
+  }
+  return opt;
+}
+
+#ifndef COUNT_TIMES_NO_MAIN	// see "Library interface" above
+int main(int argc, char** argv)
+try{
+  // test if I can instantiate Abst_Timeline (I should not be able to)
+  //Abst_Timeline at{};
+  // -> this line caused an error, as I expected
+  
+  Options opt = parse_options(argc, argv);
+
+  if(!opt.where.empty() && (opt.merge_mode || opt.query_mode || opt.publish_mode || opt.status_mode))
+    throw invalid_argument("Error: --where needs timeline files, not partial aggregates or an index");
+
+  if(opt.publish_mode){
+    if(opt.inputs.size() < 2)
+      throw invalid_argument("Error: publish takes a segment name and timeline files");
+    parse_fields.content = false; // only the totals are published
+    run_publisher(opt.inputs[0], vector<string>(opt.inputs.begin()+1, opt.inputs.end()), opt.poll);
+    return 0;
+  }
+
+  if(opt.status_mode){
+    if(opt.inputs.size() != 1)
+      throw invalid_argument("Error: status takes a segment name");
+    print_live_totals(cout, read_live_totals(opt.inputs[0]), wall_clock_now());
+    return 0;
+  }
+
+  if(opt.edit_mode){
+    if(opt.inputs.size() != 1)
+      throw invalid_argument("Error: edit takes one timeline file");
+    ifstream ifs{opt.inputs[0]};
+    if(!ifs)
+      throw invalid_argument("Error: cannot open file " + opt.inputs[0]);
+    Edit_session session{ifs};
+    run_edit_session(session, cin, cout);
+    return 0;
+  }
+
+  if(opt.cube_mode){
+    // count_times cube <cube file>...: roll up saved cubes (the cubes of several files are added up)
+    Cube cube;
+    for(const string& fname : opt.inputs){
+      ifstream ifs{fname, ios_base::binary};
+      if(!ifs)
+	throw invalid_argument("Error: cannot open file " + fname);
+      cube.read(ifs);
+    }
+    if(opt.rollups.empty())
+      opt.rollups.push_back({"person", "activity"});
+    for(const vector<string>& dims : opt.rollups)
+      cube.print_rollup(cout, dims);
+    if(!opt.cube.empty()){	// the combined cube
+      ofstream ofs{opt.cube, ios_base::binary};
+      if(!ofs)
+	throw invalid_argument("Error: cannot open file " + opt.cube);
+      cube.write(ofs);
+    }
+    return 0;
+  }
+
+  if(opt.query_mode){
+    // count_times query <index> <word>...: the report of the entries containing all the words
+    ifstream ifs{opt.inputs[0], ios_base::binary};
+    if(!ifs)
+      throw invalid_argument("Error: cannot open file " + opt.inputs[0]);
+    Content_index cindex;
+    cindex.read(ifs);
+    vector<string> words;
+    for(size_t k=1; k<opt.inputs.size(); ++k)
+      for(const string& w : split_words(opt.inputs[k])) // "code review" -> "code", "review"
+	words.push_back(w);
+    if(words.empty())
+      throw invalid_argument("Error: you need to specify the words to search for");
+    print_report(cout, cindex.query(words, opt.from, opt.to));
+    return 0;
+  }
+
+  opt.inputs = expand_directories(opt.inputs); // e.g. count_times team/ (all the files in team/ and its subdirectories)
+
+  if(opt.build_date_index){
+    for(const string& fname : opt.inputs){
+      Date_index dix = build_date_index(fname);
+      ofstream ofs{date_index_name(fname), ios_base::binary};
+      if(!ofs)
+	throw invalid_argument("Error: cannot open file " + date_index_name(fname));
+      dix.write(ofs);
+      cerr << date_index_name(fname) << ": " << dix.entries.size() << " days" << endl;
+    }
+    return 0;
+  }
+
+  // --from/--to for timeline files: the rows outside the days are filtered out (as --where "date>=... and date<...").
+  // The files with a date index are read only around those days (see read_timeline_days()).
+  bool has_days = opt.from != numeric_limits<time_t>::min() || opt.to != numeric_limits<time_t>::max();
+  if(has_days){
+    if(opt.merge_mode)
+      throw invalid_argument("Error: --from and --to need timeline files, not partial aggregates");
+    if(opt.from >= opt.to)
+      throw invalid_argument("Error: --from must be before --to");
+    string range;
+    char buff[16];
+    if(opt.from != numeric_limits<time_t>::min()){
+      strftime(buff, sizeof(buff), "%F", gmtime(&opt.from));
+      range = string("date>=") + buff;
+    }
+    if(opt.to != numeric_limits<time_t>::max()){
+      strftime(buff, sizeof(buff), "%F", gmtime(&opt.to));
+      range += (range.empty() ? "date<" : " and date<") + string(buff);
+    }
+    opt.where = opt.where.empty() ? range : "(" + opt.where + ") and " + range;
+  }
+
+  Aggregate total;
+  total.with_sketches = opt.distribution;
+  Interval_index index;
+  Content_index cindex;
+  Heatmap heatmap;
+  Cube cube;
+  bool use_cube = !opt.cube.empty() || !opt.rollups.empty();
+  bool use_index = !opt.at.empty() || opt.overlaps;
+  if(use_index && opt.merge_mode)
+    throw invalid_argument("Error: --at and --overlaps need timeline files, not partial aggregates");
+  unique_ptr<Where_filter> where;
+  if(!opt.where.empty())
+    where.reset(new Where_filter{opt.where}); // compiled after --taxonomy is read, to know all activity types
+  if(opt.merge_devices && (opt.merge_mode || opt.pipeline))
+    throw invalid_argument("Error: --merge-devices cannot be used with merge or --pipeline");
+  if(use_cube && opt.merge_mode)
+    throw invalid_argument("Error: --cube and --rollup need timeline files, not partial aggregates");
+  if(opt.heatmap && opt.merge_mode)
+    throw invalid_argument("Error: --heatmap needs timeline files, not partial aggregates");
+  // the reports are made after --taxonomy is read, like --where, and their files are opened before reading the inputs
+  vector<unique_ptr<Report_aggregator>> reports;
+  vector<unique_ptr<ofstream>> report_files;
+  if(!opt.reports.empty() && opt.merge_mode)
+    throw invalid_argument("Error: --report needs timeline files, not partial aggregates");
+  for(const string& spec : opt.reports){
+    reports.emplace_back(new Report_aggregator{spec});
+    if(!reports.back()->out.empty()){
+      report_files.emplace_back(new ofstream{reports.back()->out});
+      if(!*report_files.back())
+	throw invalid_argument("Error: cannot open file " + reports.back()->out);
+    }
+    else
+      report_files.emplace_back();
+  }
+  unique_ptr<Interval_exporter> exporter;
+  if(!opt.export_intervals.empty()){
+    if(opt.merge_mode)
+      throw invalid_argument("Error: --export-intervals needs timeline files, not partial aggregates");
+    string format{opt.export_format};
+    if(format.empty()){		// from the extension
+      const string& f = opt.export_intervals;
+      auto ends_with = [&f](const string& ext){return f.size() >= ext.size() && f.compare(f.size()-ext.size(), ext.size(), ext) == 0;};
+      format = ends_with(".ndjson") || ends_with(".jsonl") ? "ndjson" : ends_with(".bin") || ends_with(".ctiv") ? "binary" : "csv";
+    }
+    exporter.reset(new Interval_exporter{opt.export_intervals, format});
+  }
+  unique_ptr<Dedup_set> dedup;
+  if(opt.dedup)
+    dedup.reset(new Dedup_set{time_t(opt.dedup_window) * 86400});
+  if(!opt.build_index.empty() && opt.merge_mode)
+    throw invalid_argument("Error: --build-index needs timeline files, not partial aggregates");
+
+  unique_ptr<Journal> journal;
+  if(!opt.journal.empty()){
+    // the files recorded in the journal are not read again, so the outputs needing every timeline cannot be made
+    if(opt.merge_mode || opt.merge_devices || opt.dedup || use_index || !opt.build_index.empty() || opt.heatmap
+       || use_cube || !reports.empty() || exporter)
+      throw invalid_argument("Error: --journal can be used only with the total times, --where, --main-only, "
+			     "--distribution and --emit-partial");
+    journal.reset(new Journal{opt.journal, journal_fingerprint(opt.where, opt.main_only), opt.checkpoint});
+  }
+
+  // Decode only what the requested outputs read (see Parse_fields). The content is read by --where content~, the
+  // phrases of --distribution (and of partial aggregates, which keep the sketches), the content index and --dedup.
+  parse_fields.subs = !opt.main_only;
+  parse_fields.content = (where && where->uses_content()) || opt.distribution || !opt.emit_partial.empty()
+    || !opt.build_index.empty() || opt.dedup || journal
+    || any_of(reports.begin(), reports.end(), [](const unique_ptr<Report_aggregator>& r){return r->uses_content();});
+  if(opt.merge_mode){
+    vector<Aggregate> partials;
+    for(const string& fname : opt.inputs){
+      ifstream ifs{fname, ios_base::binary};
+      if(!ifs)
+	throw invalid_argument("Error: cannot open file " + fname);
+      partials.push_back(read_partial(ifs));
+    }
+    // to stitch adjacent shards, merge them in the order of time
+    stable_sort(partials.begin(), partials.end(), [](const Aggregate& a, const Aggregate& b){
+      return a.has_entries && (!b.has_entries || a.first_t < b.first_t);
+    });
+    for(const Aggregate& p : partials)
+      total.merge(p, opt.stitch);
+  }
+  else{
+    // Each timeline file is aggregated separately (each file starts with its own date line), and then merged.
+    int n_parsers = opt.parsers ? opt.parsers : max(1, int(thread::hardware_concurrency())-2);
+    // (one core for the reader, one for the aggregator, and the rest for the parsers)
+    size_t n_files = opt.merge_devices ? 1 : opt.inputs.size(); // (--merge-devices: all files are read as the first one)
+    for(size_t file=0; file<n_files; ++file){
+      const string& fname = opt.inputs[file];
+      vector<Entry_listener> listeners;
+      if(use_index)
+	listeners.push_back([&index, file](const Resolved_entry& re){add_to_interval_index(index, re, file);});
+      if(!opt.build_index.empty())
+	listeners.push_back([&cindex](const Resolved_entry& re){cindex.add(re);});
+      if(opt.heatmap)
+	listeners.push_back([&heatmap, &where](const Resolved_entry& re){heatmap.add(re, where.get());});
+      for(auto& r : reports)
+	listeners.push_back([&r](const Resolved_entry& re){r->add(re);});
+      if(exporter)
+	listeners.push_back([&exporter, &where](const Resolved_entry& re){exporter->add(re, where.get());});
+      if(use_cube){
+	int person = cube.intern_person(person_of(fname, opt.person_from));
+	listeners.push_back([&cube, person, &where](const Resolved_entry& re){cube.add_entry(person, re, where.get());});
+      }
+
+      File_stamp stamp{};
+      if(journal){
+	stamp = file_stamp(fname);
+	if(const Aggregate* done = journal->find(fname, stamp)){
+	  total.merge(*done);	// counted in an earlier run
+	  continue;
+	}
+      }
+
+      Aggregate agg;
+      agg.with_sketches = opt.distribution || !opt.emit_partial.empty() || journal;
+      agg.where = where.get();
+      agg.dedup = dedup.get();
+      agg.from = opt.from;
+      agg.to = opt.to;
+      // (partials keep the sketches, so that the merged partials can show --distribution)
+      auto fail = [&journal, &fname](){
+	if(journal){
+	  journal->sync();
+	  cerr << journal->size() << " files are recorded in the journal. After fixing " << fname
+	       << ", run the same command again to continue from it" << endl;
+	}
+	return 1;
+      };
+      if(opt.merge_devices){
+	read_device_files(opt.inputs, agg, listeners);
+	total.merge(agg);
+	continue;
+      }
+      if(opt.pipeline){
+	if(!read_timeline_file_pipelined(fname, agg, n_parsers, opt.stats, listeners))
+	  return fail();
+      }
+      else if(unique_ptr<Date_index> dix = has_days ? load_date_index(fname) : nullptr){
+	long long from = opt.from == numeric_limits<time_t>::min() ? numeric_limits<long long>::min() : opt.from/86400;
+	long long to = opt.to == numeric_limits<time_t>::max() ? numeric_limits<long long>::max() : opt.to/86400;
+	if(!read_timeline_days(fname, *dix, from, to, agg, listeners))
+	  return fail();
+      }
+      else{
+	unique_ptr<istream> in = open_input(fname); // gzip/zstd files are decompressed on the fly
+	if(!read_timeline_file(*in, agg, listeners))
+	  return fail();
+      }
+      if(journal)
+	journal->append(fname, stamp, agg);
+      total.merge(agg);
+    }
+    if(journal)
+      journal->sync();
+  }
+
+  if(dedup && dedup->n_skipped)
+    cerr << "Skipped " << dedup->n_skipped << " duplicated timelines" << endl;
+
+  if(exporter){
+    exporter->close();
+    if(opt.export_intervals == "-")
+      return 0;			// the intervals are the output
+  }
+
+  if(!opt.cube.empty()){
+    ofstream ofs{opt.cube, ios_base::binary};
+    if(!ofs)
+      throw invalid_argument("Error: cannot open file " + opt.cube);
+    cube.write(ofs);
+  }
+
+  if(!opt.build_index.empty()){
+    ofstream ofs{opt.build_index, ios_base::binary};
+    if(!ofs)
+      throw invalid_argument("Error: cannot open file " + opt.build_index);
+    cindex.write(ofs);
+  }
+
+  if(!opt.emit_partial.empty()){
+    ofstream ofs{opt.emit_partial, ios_base::binary};
+    if(!ofs)
+      throw invalid_argument("Error: cannot open file " + opt.emit_partial);
+    write_partial(ofs, total);
+    return 0;
+  }
+
+  if(use_index){
+    // show the answers of the queries instead of the total times
+    index.build();
+    for(time_t t : opt.at)
+      print_point_query(cout, index, t, opt.inputs);
+    if(opt.overlaps)
+      print_overlaps(cout, index, opt.inputs);
+    return 0;
+  }
+
+  if(!reports.empty()){
+    // show the requested reports instead of the total times. When several reports go to stdout, each one has a title.
+    int n_stdout = count_if(report_files.begin(), report_files.end(), [](const unique_ptr<ofstream>& f){return !f;});
+    for(size_t k=0; k<reports.size(); ++k){
+      if(report_files[k]){
+	reports[k]->print(*report_files[k]);
+	if(!*report_files[k])
+	  throw runtime_error("Error in writing " + reports[k]->out);
+	continue;
+      }
+      if(n_stdout > 1)
+	cout << "== " << reports[k]->spec << " ==" << endl;
+      reports[k]->print(cout);
+    }
+    return 0;
+  }
+
+  if(!opt.rollups.empty()){
+    // show the roll-ups instead of the total times
+    for(const vector<string>& dims : opt.rollups)
+      cube.print_rollup(cout, dims);
+    return 0;
+  }
+
+  print_report(cout, total);
+  if(opt.distribution)
+    print_distribution(cout, total, opt.top);
+  if(opt.heatmap)
+    print_heatmap(cout, heatmap, opt.bucket);
   
   return 0;
  }
@@ -1357,3 +7064,4 @@ try{
    cerr << "Error: Unknown exception is caught\n";
    return 1;
  }
+#endif // COUNT_TIMES_NO_MAIN
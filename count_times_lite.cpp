@@ -0,0 +1,685 @@
+
+// count_times_lite: a small build of count_times for editor hooks and status bars, which run it on every save of a
+// short timeline file. There, most of the time of count_times went to starting up (the iostream and locale
+// initialization, and the regexes compiled for each line), not to reading a few dozen lines.
+// This program prints the same report as "count_times <files>" with the built-in activity types, but uses only
+// read()/write(), a hand-written lexer instead of istream/get_time()/regex, and fixed-size arrays on the stack, so it
+// can be linked statically into a small binary:
+//   g++ -std=c++17 -Os -static -fno-exceptions -fno-rtti -o count_times_lite count_times_lite.cpp
+// It has no options. Anything else (taxonomy files, --where, compressed files, ...) needs count_times.
+//
+// The lexer below follows operator>>(istream&, Timeline&) in count_times.cpp step by step, including how istream
+// reads (e.g. "is >> c" skips whitespaces, a failed stream stays failed), so that the same lines are accepted and
+// the same times are counted. When that parser changes, this one has to be changed, too.
+
+#include<unistd.h>		// for read(), write(), _exit()
+#include<fcntl.h>		// for open()
+#include<string.h>		// for strlen(), memmove()
+#include<stdint.h>		// for uint32_t
+
+namespace {
+
+// Limits of the fixed-size arrays. They are far above what a timeline file has, and when one is exceeded, the
+// program stops with an error rather than counting something wrong.
+const int max_line = 64*1024;	// bytes of one line
+const int max_subs = 64;	// sub-activities of one timeline
+const int n_tasks = 10;		// task digits 0-9
+
+// the built-in taxonomy of count_times.cpp (Taxonomy::Taxonomy()). Index 0 is not a category, and the last
+// one (error) has no code.
+enum {not_set=1, task, wasteful, house_chore, social, write_log, miscellaneous, exercise, travel, rest, pastime,
+      error, n_categories};
+const char category_codes[n_categories] = {0, 'n', 't', 'w', 'h', 's', 'l', 'm', 'e', 'd', 'r', 'p', 0};
+const char* const category_labels[n_categories] = {"", "not_set", "Task", "wasteful activity", "house chore",
+						   "social activity", "log writing", "miscellaneous activity",
+						   "exercise", "travel", "rest", "pastime", "error"};
+
+// ############################################################
+// Output (stdout is written once at the end, stderr right away)
+// ############################################################
+
+struct Out_buffer {
+  char buf[4096];
+  int n{0};
+
+  void put(const char* s){
+    for(; *s; ++s){
+      if(n == sizeof(buf))
+	flush();
+      buf[n++] = *s;
+    }
+  }
+  void put(long long v){
+    char tmp[24];
+    int k = sizeof(tmp);
+    tmp[--k] = 0;
+    bool neg = v < 0;
+    unsigned long long u = neg ? 0ULL - (unsigned long long)v : v;
+    do{
+      tmp[--k] = char('0' + u%10);
+      u /= 10;
+    } while(u);
+    if(neg)
+      tmp[--k] = '-';
+    put(tmp+k);
+  }
+  void flush(int fd = 1){
+    for(int w = 0; w < n; ){
+      ssize_t r = ::write(fd, buf+w, n-w);
+      if(r <= 0)
+	break;
+      w += r;
+    }
+    n = 0;
+  }
+};
+
+void err(const char* s){
+  ::write(2, s, strlen(s));
+}
+
+// print the messages and stop with exit status 1. count_times prints nothing to stdout before the report either,
+// so stopping here gives the same output as count_times, which returns 1 from main().
+[[noreturn]] void fail(const char* s1, const char* s2 = "", const char* s3 = ""){
+  err(s1); err(s2); err(s3);
+  _exit(1);
+}
+
+[[noreturn]] void fail_at(const char* before, long long c, const char* after){
+  Out_buffer e;
+  e.put(before);
+  e.put(c);
+  e.put(after);
+  e.flush(2);
+  _exit(1);
+}
+
+// ############################################################
+// Characters (the "C" locale of count_times' istreams, by hand)
+// ############################################################
+
+inline bool is_digit(char c){return c >= '0' && c <= '9';}
+inline bool is_space(char c){return c == ' ' || (c >= '\t' && c <= '\r');}
+inline char to_lower(char c){return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;}
+
+// activity type of a code letter (either case), or error
+int lookup(char c){
+  c = to_lower(c);
+  for(int i=1; i<error; ++i)
+    if(category_codes[i] == c)
+      return i;
+  return error;
+}
+
+// the same mapping as normalize_utf8() in count_times.cpp, without the SSE2 part (lines are short here)
+char ascii_equivalent(uint32_t cp){
+  if((cp >= 0x2010 && cp <= 0x2015) || cp == 0x2212)
+    return '-';
+  if(cp >= 0xff01 && cp <= 0xff5e)
+    return char(cp - 0xfee0);
+  if(cp == 0x3000)
+    return ' ';
+  if(cp == 0x301c)
+    return '~';
+  return 0;
+}
+
+int decode_utf8(const char* s, int i, int n, uint32_t& cp){
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(s+i);
+  int len;
+  uint32_t lo{0x80};
+  if(u[0] >= 0xc2 && u[0] <= 0xdf){len = 2; cp = u[0] & 0x1f;}
+  else if(u[0] >= 0xe0 && u[0] <= 0xef){len = 3; cp = u[0] & 0x0f; lo = 0x800;}
+  else if(u[0] >= 0xf0 && u[0] <= 0xf4){len = 4; cp = u[0] & 0x07; lo = 0x10000;}
+  else
+    return 0;
+  if(i + len > n)
+    return 0;
+  for(int k=1; k<len; ++k){
+    if((u[k] & 0xc0) != 0x80)
+      return 0;
+    cp = cp << 6 | (u[k] & 0x3f);
+  }
+  if(cp < lo || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    return 0;
+  return len;
+}
+
+// normalize s[0, n) in place and return the new length
+int normalize_utf8(char* s, int n){
+  int w{0};
+  for(int r=0; r<n; ){
+    if(static_cast<unsigned char>(s[r]) < 0x80){
+      s[w++] = s[r++];
+      continue;
+    }
+    uint32_t cp;
+    int len = decode_utf8(s, r, n, cp);
+    if(!len){
+      s[w++] = s[r++];
+      continue;
+    }
+    if(char c = ascii_equivalent(cp)){
+      s[w++] = c;
+      r += len;
+    }
+    else{
+      memmove(s+w, s+r, len);
+      w += len;
+      r += len;
+    }
+  }
+  return w;
+}
+
+// ############################################################
+// Lexer
+// ############################################################
+
+// A read position in a line, with the same failure rules as istream: once a read fails (e.g. at the end of the
+// line), every following read fails, and the character is left as it was.
+struct Cursor {
+  const char* p;
+  const char* end;
+  bool failed{false};
+
+  bool next(char& c){		// is >> c (skips whitespaces)
+    if(failed)
+      return false;
+    while(p < end && is_space(*p))
+      ++p;
+    if(p == end)
+      return !(failed = true);
+    c = *p++;
+    return true;
+  }
+  bool get(char& c){		// is.get(c)
+    if(failed)
+      return false;
+    if(p == end)
+      return !(failed = true);
+    c = *p++;
+    return true;
+  }
+  void unget(){			// is.unget() or is.putback(c) of the last character read
+    if(!failed)
+      --p;
+  }
+};
+
+// get_time() with "%H" or "%M" ("%m", "%d", "%Y" for the date): at most len digits, within [lo, hi]
+bool read_number(Cursor& is, int len, int lo, int hi, int& v){
+  int i{0};
+  v = 0;
+  for(; is.p < is.end && i < len && is_digit(*is.p); ++i, ++is.p){
+    v = v*10 + (*is.p - '0');
+    if(v > hi)
+      break;
+  }
+  if(i == 0 || v < lo || v > hi)
+    return !(is.failed = true);
+  return true;
+}
+
+// get_time() with a literal character of the format
+bool read_char(Cursor& is, char c){
+  if(is.p == is.end || *is.p != c)
+    return !(is.failed = true);
+  ++is.p;
+  return true;
+}
+
+// "%H:%M" into minutes since 0:00
+bool read_hm(Cursor& is, int& min){
+  int h, m;
+  if(!read_number(is, 2, 0, 23, h) || !read_char(is, ':') || !read_number(is, 2, 0, 59, m))
+    return false;
+  min = h*60 + m;
+  return true;
+}
+
+// read_timestamp() of count_times.cpp
+bool read_timestamp(Cursor& is, int& min, bool recover_time_chars = false){
+  char c{0};
+  is.next(c);
+  if(c != '~' && is_digit(c))
+    is.unget();
+  else if(c == '~'){
+    is.next(c);
+    if(!is_digit(c)){
+      err("Error in reading a timeline: after activity types, missing time e.g. (~)19:20\n");
+      return !(is.failed = true);
+    }
+    is.unget();
+  }
+  else{
+    err("Error in reading a timeline: after activity types, missing time e.g. (~)19:20\n");
+    return !(is.failed = true);
+  }
+  const char* pos = is.p;
+  if(!read_hm(is, min)){
+    if(recover_time_chars)
+      is.p = pos;
+    return false;
+  }
+  return true;
+}
+
+// read_duration() of count_times.cpp. The regex there, (\d+)\s*(h|...)|(\d+)\s*(m|...) (ignoring case), only
+// depends on the letter following a run of digits, so it's matched by hand.
+bool read_duration(Cursor& is, unsigned int& duration){
+  is.failed = false;		// is.clear()
+  char c{0};
+  is.next(c);
+  if(c != '~' && is_digit(c))
+    is.unget();
+  else if(c == '~'){
+    is.next(c);
+    if(!is_digit(c)){
+      err("Error in reading a timeline: after activity types, missing time e.g. (~)15m\n");
+      return !(is.failed = true);
+    }
+    is.unget();
+  }
+  else{
+    err("Error in reading a timeline: after activity types, missing time e.g. (~)15m\n");
+    return !(is.failed = true);
+  }
+
+  // getline(is, time_qual, ')')
+  const char* q = is.p;
+  const char* q_end = q;
+  while(q_end < is.end && *q_end != ')')
+    ++q_end;
+  is.p = q_end < is.end ? q_end+1 : q_end;
+
+  int hours{0}, mins{0};
+  bool matched{false};
+  for(const char* s = q; s < q_end; ){
+    if(!is_digit(*s)){
+      ++s;
+      continue;
+    }
+    const char* d = s;
+    long long v{0};
+    for(; d < q_end && is_digit(*d); ++d)
+      if((v = v*10 + (*d - '0')) > 0x7fffffff)
+	fail("stoi\n");		// what count_times' stoi() throws
+    const char* u = d;
+    while(u < q_end && is_space(*u))
+      ++u;
+    if(u < q_end && (to_lower(*u) == 'h' || to_lower(*u) == 'm')){
+      (to_lower(*u) == 'h' ? hours : mins) = v;
+      matched = true;
+      s = u+1;
+    }
+    else
+      s = d;		// (a match starting inside the digits would be followed by the same character)
+  }
+  if(!matched){
+    err("Error in reading a timeline: after activity types, missing a correct duration with time qualifier (m/min/mins/minute/minutes/h/hr/hrs/hour/hours) e.g. (~)15m\n");
+    return !(is.failed = true);
+  }
+  duration += hours*60;
+  duration += mins;
+  return true;
+}
+
+struct Sub {
+  int a;
+  int task_num;
+  unsigned int duration;	// [minutes]
+};
+
+struct Timeline {
+  int a;
+  int task_num;
+  int end_min;			// minutes since 0:00
+  Sub subs[max_subs];
+  int n_subs;
+
+  void push(const Sub& s){
+    if(n_subs == max_subs)
+      fail("Error: too many sub-activities in one timeline for count_times_lite\n");
+    subs[n_subs++] = s;
+  }
+};
+
+long long date_days;		// the "date" of count_times.cpp, in days since 1970-01-01
+
+// days since 1970-01-01 of y/m/d. A day past the end of the month goes on to the next month, as with timegm().
+long long days_from_civil(long long y, int m, int d){
+  y -= m <= 2;
+  long long era = (y >= 0 ? y : y-399) / 400;
+  long long yoe = y - era*400;
+  long long doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5;
+  long long doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  return era*146097 + doe - 719468 + d - 1;
+}
+
+// set_dates() of count_times.cpp with minutes: b and e are put on day ref, and e on the next day if it's before b.
+// Returns the day of e.
+long long set_dates(long long ref, int b_min, int e_min, long long& b, long long& e){
+  b = ref*1440 + b_min;
+  e = ref*1440 + e_min;
+  if(e < b){
+    if(b - e < 60)
+      fail("Error in reading a timeline: the next time stamp is before the target time stamp.\n", "Runtime Error\n");
+    e += 1440;
+    return ref+1;
+  }
+  return ref;
+}
+
+// read_sub_timestamp() of count_times.cpp
+bool read_sub_timestamp(Cursor& is, Sub& sub){
+  int b_min, e_min;
+  if(read_timestamp(is, b_min, true)){
+    char ct{0};
+    is.next(ct);
+    if(ct != '-'){
+      err("Error in reading the beginning/end time stamps of a sub-activity. The format is e.g. \"(~)19:20 - (~)20:15\"\n");
+      err("No following question marks are allowed, e.g. \"(~)19:20? - (~)20:15\"? will cause this error. \n");
+      err("Also, check the hyphen. ASCII hyphen '-' and dashes like \xe2\x80\x93 (en-dash) or \xe2\x80\x94 (em-dash) are accepted (see normalize_utf8()), but other symbols are not\n");
+      return !(is.failed = true);
+    }
+    if(!read_timestamp(is, e_min, false))
+      return !(is.failed = true);
+    long long b, e;
+    set_dates(date_days, b_min, e_min, b, e);
+    sub.duration += e - b;
+  }
+  else if(!read_duration(is, sub.duration))
+    return false;
+  return !is.failed;
+}
+
+// get_task_num() of count_times.cpp
+void get_task_num(Cursor& is, int& task_num){
+  char c{0};
+  is.get(c);
+  if(is_digit(c))
+    task_num = c - '0';
+  else
+    is.unget();
+}
+
+bool unknown_type(char c){
+  char s[2] = {c, 0};
+  err("Error: Unknown activity type '"); err(s); err("' is specified\n");
+  return false;
+}
+
+// operator>>(istream&, Timeline&) of count_times.cpp (see the comments of its sections there)
+bool parse_timeline(const char* line, const char* line_end, Timeline& t){
+  Cursor is{line, line_end};
+  t.a = not_set;
+  t.task_num = 0;
+  t.n_subs = 0;
+
+  char c{0};
+  is.next(c);
+  if(c != '-'){
+    err("Error in reading a timeline: missing '-' at the front\n");
+    return false;
+  }
+
+  // section 1
+  is.next(c);
+  c = to_lower(c);
+  if((t.a = lookup(c)) == error)
+    return unknown_type(c);
+  if(t.a == task)
+    get_task_num(is, t.task_num);
+
+  // section 2
+  is.next(c);
+  while(c == '+'){
+    is.next(c);
+    c = to_lower(c);
+    Sub sub{lookup(c), 0, 0};
+    if(sub.a == error)
+      return unknown_type(c);
+    if(sub.a == task)
+      get_task_num(is, sub.task_num);
+    t.push(sub);
+    is.next(c);
+  }
+  is.unget();
+
+  if(!read_timestamp(is, t.end_min))
+    return false;
+
+  // the content (an empty one fails like getline() at the end of the stream)
+  while(is.p < is.end && is_space(*is.p))
+    ++is.p;
+  if(is.failed || is.p == is.end)
+    return false;
+  const char* content = is.p;
+
+  // section 2.5
+  Cursor iss{content, line_end};
+  while(iss.next(c)){
+    int act;
+    if(c == '(' && iss.next(c) && (act = lookup(c)) != error){
+      Sub sub{act, 0, 0};
+      if(act == task)
+	get_task_num(iss, sub.task_num);
+      if(iss.get(c) && is_space(c)){
+	bool captured{false};
+	for(int i=0; i<t.n_subs; ++i)
+	  if(t.subs[i].a == act && t.subs[i].task_num == sub.task_num){
+	    captured = true;
+	    break;
+	  }
+	if(!captured)
+	  t.push(sub);
+      }
+    }
+  }
+
+  // section 3
+  for(int i=0; i<t.n_subs; ++i){
+    char ct;
+    int at = t.subs[i].a;
+    Cursor iss{content, line_end};
+    Sub sub = t.subs[i];
+    while(iss.next(ct)){
+      if(ct == '(' && iss.next(ct) && lookup(ct) == at){
+	int task_num2{0};
+	if(at == task)
+	  get_task_num(iss, task_num2);
+	if(iss.get(ct) && is_space(ct) && sub.task_num == task_num2)
+	  if(!read_sub_timestamp(iss, sub))
+	    return false;
+      }
+    }
+    t.subs[i] = sub;
+  }
+
+  // section 4 (regex "task (\d)")
+  int task_nums[max_line/6 + 1];
+  int n_task_nums{0};
+  for(const char* s = content; s + 6 <= line_end; ){
+    if(s[0] == 't' && s[1] == 'a' && s[2] == 's' && s[3] == 'k' && s[4] == ' ' && is_digit(s[5])){
+      task_nums[n_task_nums++] = s[5] - '0';
+      s += 6;
+    }
+    else
+      ++s;
+  }
+  int vec_i{0};
+  if(n_task_nums){
+    if(t.a == task && t.task_num == 0)
+      t.task_num = task_nums[vec_i++];
+    for(int i=0; i<t.n_subs && vec_i<n_task_nums; ++i)
+      if(t.subs[i].a == task && t.subs[i].task_num == 0)
+	t.subs[i].task_num = task_nums[vec_i++];
+  }
+  return true;
+}
+
+// ############################################################
+// Aggregation
+// ############################################################
+
+struct Totals {
+  long long act_min[n_categories];
+  long long task_min[n_tasks];
+  int n_task_min{1};		// task_min[0, n_task_min) are reported, like the size of Aggregate::task_min
+
+  void add(int a, int task_num, long long min){
+    act_min[a] += min;
+    if(a == task){
+      if(n_task_min < task_num+1)
+	n_task_min = task_num+1;
+      task_min[task_num] += min;
+    }
+  }
+};
+
+// read_date() of count_times.cpp: get_time() with "%m/%d/%Y" after whitespaces
+bool read_date(char* line, int n){
+  n = normalize_utf8(line, n);
+  Cursor is{line, line+n};
+  while(is.p < is.end && is_space(*is.p))
+    ++is.p;
+  int m, d, y;
+  if(!read_number(is, 2, 1, 12, m) || !read_char(is, '/') || !read_number(is, 2, 1, 31, d)
+     || !read_char(is, '/') || !read_number(is, 4, 0, 9999, y)){
+    err("Error in reading the first line as a date\n");
+    err("Required format: mm/dd/yyyy, e.g. 9/15/2025\n");
+    return false;
+  }
+  date_days = days_from_civil(y, m, d);
+  return true;
+}
+
+// Ingest of count_times.cpp for one file
+struct Ingest {
+  Totals& totals;
+  Timeline prev{}, cur{};
+  long long c{1};
+  long long first_c{1};
+  bool has_date{false};
+
+  void feed(char* line, int n);
+};
+
+void Ingest::feed(char* line, int n){
+  if(!has_date){
+    if(!read_date(line, n))
+      _exit(1);
+    has_date = true;
+    return;
+  }
+  n = normalize_utf8(line, n);
+  int i{0};
+  while(i < n && (line[i] == ' ' || line[i] == '\t'))
+    ++i;
+  if(i < n && is_digit(line[i])){ // a date line in the middle
+    if(!read_date(line, n))
+      _exit(1);
+    first_c = ++c;
+    return;
+  }
+  if(!parse_timeline(line, line+n, cur))
+    fail_at("At ", c, "-th Timeline, an reading error happened\n");
+
+  if(c > first_c){
+    long long b, e;
+    date_days = set_dates(date_days, prev.end_min, cur.end_min, b, e);
+    double seconds = (e - b)*60;
+    for(int i=0; i<cur.n_subs; ++i){
+      seconds -= cur.subs[i].duration*60;
+      if(seconds < 0){
+	err("Error in subtracting sub-activity's duration from the main activity's duration.\n");
+	fail_at("", c, "-th Timeline, The main duration became negative\n");
+      }
+    }
+    for(int i=0; i<cur.n_subs; ++i)
+      totals.add(cur.subs[i].a, cur.subs[i].task_num, cur.subs[i].duration);
+    totals.add(cur.a, cur.task_num, (long long)(seconds/60));
+  }
+  prev = cur;
+  ++c;
+}
+
+void read_file(const char* fname, Totals& totals){
+  int fd = open(fname, O_RDONLY);
+  if(fd < 0)
+    fail("Error: cannot open file ", fname, "\n");
+
+  char chunk[64*1024];
+  char line[max_line];
+  int n{0};			// the length of the line read so far
+  Ingest ingest{totals};
+  bool first_chunk{true};
+  for(;;){
+    ssize_t r = ::read(fd, chunk, sizeof(chunk));
+    if(r < 0)
+      fail("Error: cannot read file ", fname, "\n");
+    if(r == 0)
+      break;
+    if(first_chunk && r >= 2 && (unsigned char)chunk[0] == 0x1f && (unsigned char)chunk[1] == 0x8b)
+      fail("Error: ", fname, " is compressed. Use count_times to read it\n");
+    if(first_chunk && r >= 4 && (unsigned char)chunk[0] == 0x28 && (unsigned char)chunk[1] == 0xb5
+       && (unsigned char)chunk[2] == 0x2f && (unsigned char)chunk[3] == 0xfd)
+      fail("Error: ", fname, " is compressed. Use count_times to read it\n");
+    first_chunk = false;
+    for(ssize_t k=0; k<r; ++k){
+      if(chunk[k] == '\n'){
+	ingest.feed(line, n);
+	n = 0;
+      }
+      else if(n == max_line)
+	fail("Error: a line of ", fname, " is too long for count_times_lite\n");
+      else
+	line[n++] = chunk[k];
+    }
+  }
+  if(n > 0 || !ingest.has_date)	// the last line without '\n' (or an empty file, whose date line is missing)
+    ingest.feed(line, n);
+  close(fd);
+}
+
+// print_report() of count_times.cpp with the built-in taxonomy (no parent categories)
+void print_report(const Totals& totals){
+  Out_buffer out;
+  for(int i=1; i<error; ++i){
+    out.put("Total ");
+    out.put(category_labels[i]);
+    out.put(" time: ");
+    out.put(totals.act_min[i]);
+    out.put(" [mins]\n");
+    if(i == task){
+      out.put("\tUnclassified task time: ");
+      out.put(totals.task_min[0]);
+      out.put(" [mins]\n");
+      for(int k=1; k<totals.n_task_min; ++k){
+	out.put("\tTask ");
+	out.put((long long)k);
+	out.put(" time: ");
+	out.put(totals.task_min[k]);
+	out.put(" [mins]\n");
+      }
+    }
+  }
+  out.flush();
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+  if(argc < 2)
+    fail("Error: you need to specify the text file name with timelines\n");
+  for(int i=1; i<argc; ++i)
+    if(argv[i][0] == '-' && argv[i][1])
+      fail("Error: count_times_lite takes only timeline files. Use count_times for ", argv[i], "\n");
+
+  Totals totals{};
+  for(int i=1; i<argc; ++i)
+    read_file(argv[i], totals);
+  print_report(totals);
+  return 0;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Checks that --from/--to give the same outputs with and without a date index (--build-date-index): the total times
+# and everything fed with the resolved timelines (--export-intervals, --heatmap, --report, --build-index, --at,
+# --overlaps, --rollup, --cube). Also checks that --merge-devices treats date lines in the middle of a file the same.
+# Usage: ./test_date_index.sh [count_times]	(without an argument, count_times.cpp is compiled into the work directory)
+
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+ct=${1:-$dir/count_times}
+[ -n "$1" ] || g++ -std=c++17 -O2 -o "$ct" "$(dirname "$0")/count_times.cpp"
+
+# An archive of 10 days made from example_timelines.txt. Every other day has no date line: it's reached by the date
+# rollover at "- r 7:30" after the previous day's last timeline (20:30), as in a file written without date lines.
+body=$(tail -n +2 "$(dirname "$0")/example_timelines.txt")
+for d in 01 02 03 04 05 06 07 08 09 10; do
+  case $d in
+    0[13579]) echo "03/$d/2025" ;;
+    *) echo "- r 7:30 slept" ;;
+  esac
+  echo "$body"
+done > "$dir/archive.txt"
+
+run(){				# run <suffix> <range>: all the outputs of the range into files ending with suffix
+  "$ct" $2 --export-intervals "$dir/intervals$1" --heatmap --report total --report daily --build-index "$dir/words$1" \
+	--where 'not (type=s and sub)' "$dir/archive.txt" > "$dir/report$1"
+  "$ct" $2 --at "2025-03-04 12:10" --at "2025-03-05 08:10" --overlaps "$dir/archive.txt" > "$dir/at$1"
+  "$ct" $2 --rollup day,activity --cube "$dir/cube$1" "$dir/archive.txt" > "$dir/rollup$1"
+}
+
+"$ct" --build-date-index "$dir/archive.txt" > /dev/null
+status=0
+for range in "--from 2025-03-04 --to 2025-03-06" "--from 2025-03-05 --to 2025-03-06" "--from 2025-03-09" \
+	     "--to 2025-03-03" "--from 2025-02-01 --to 2025-03-02" "--from 2025-04-01"; do
+  mv "$dir/archive.txt.ctdx" "$dir/ctdx"
+  run .plain "$range"
+  mv "$dir/ctdx" "$dir/archive.txt.ctdx"
+  run .indexed "$range"
+  for out in intervals report words at rollup cube; do
+    if ! cmp -s "$dir/$out.plain" "$dir/$out.indexed"; then
+      echo "FAILED: $range: $out differs with the date index"
+      status=1
+    fi
+  done
+done
+
+# A date line in the middle starts again from its date with --merge-devices, too: one file gives the same result as
+# without it, also when the date line skips days (the gap must not be counted for the timeline after it).
+printf '3/4/2025\n- s 9:00 x\n- t1 10:00 a\n- r 22:00 r\n3/6/2025\n- s 9:00 x\n- t1 10:00 b\n' > "$dir/gap.txt"
+for f in archive.txt gap.txt; do
+  "$ct" "$dir/$f" > "$dir/plain"
+  "$ct" --merge-devices "$dir/$f" > "$dir/merged"
+  if ! cmp -s "$dir/plain" "$dir/merged"; then
+    echo "FAILED: $f: --merge-devices differs"
+    status=1
+  fi
+done
+[ $status = 0 ] && echo "OK"
+exit $status